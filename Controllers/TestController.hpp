@@ -2,6 +2,8 @@
 
 #include "../Internal/Request.hpp"
 #include "../Internal/Response.hpp"
+#include "../Internal/EventLoop.hpp"
+#include "../Internal/WebSocket.hpp"
 
 using namespace HTTP;
 
@@ -24,4 +26,35 @@ public:
 		
 		return Response().setStatus(HttpStatus::OK).setBody(hello);
 	}
+
+	Response upload(Request& request) {
+		json files = json::array();
+		for (const UploadedFile& file : request.files) {
+			files.push_back({ { "field", file.field }, { "filename", file.filename }, { "contentType", file.contentType }, { "size", file.size } });
+		}
+
+		json fields = json::object();
+		for (const auto& [name, value] : request.form) {
+			fields[name] = value;
+		}
+
+		return Response().setStatus(HttpStatus::OK).setJSON({ { "fields", fields }, { "files", files } });
+	}
+
+	Task<Response> delayed(Request& request) {
+		int ms = request.query.count("ms") ? std::atoi(request.query.at("ms").c_str()) : 1000;
+		co_await EventLoop::current()->sleep(std::chrono::milliseconds(ms));
+
+		co_return Response().setStatus(HttpStatus::OK).setBody("Waited " + std::to_string(ms) + " ms");
+	}
+
+	Task<void> chat(WebSocket& socket, Request& request) {
+		std::string room = request.params.count("room") ? request.params.at("room") : "lobby";
+		socket.subscribe(room);
+
+		WebSocket::Message message;
+		while (co_await socket.receive(message)) {
+			Broadcaster::getInstance().publish(room, message.data, message.binary);
+		}
+	}
 };
\ No newline at end of file
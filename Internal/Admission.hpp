@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+// Connection admission: a global connection cap, a per-client-IP cap, and
+// keep-alive timeouts that shrink as the server fills up so idle clients give
+// their slots back quickly under pressure.
+class AdmissionControl {
+private:
+    std::atomic<size_t> active{ 0 };
+
+    std::mutex ipMtx;
+    std::unordered_map<uint32_t, size_t> perIp;
+
+    // Limits may be changed by a config reload while connections are admitted.
+    std::atomic<size_t> maxConnections;
+    std::atomic<size_t> maxPerIp;
+    std::atomic<long long> keepAliveTimeout;
+    std::atomic<long long> minKeepAliveTimeout;
+
+public:
+    enum class Decision {
+        Admit,
+        RejectServerFull,
+        RejectIpLimit
+    };
+
+    AdmissionControl(size_t maxConnections, size_t maxPerIp, std::chrono::milliseconds keepAliveTimeout, std::chrono::milliseconds minKeepAliveTimeout)
+        : maxConnections(maxConnections), maxPerIp(maxPerIp), keepAliveTimeout(keepAliveTimeout.count()), minKeepAliveTimeout(minKeepAliveTimeout.count()) {
+    }
+
+    void configure(size_t connections, size_t perIp, std::chrono::milliseconds keepAlive, std::chrono::milliseconds minKeepAlive) {
+        maxConnections.store(connections, std::memory_order_relaxed);
+        maxPerIp.store(perIp, std::memory_order_relaxed);
+        keepAliveTimeout.store(keepAlive.count(), std::memory_order_relaxed);
+        minKeepAliveTimeout.store(minKeepAlive.count(), std::memory_order_relaxed);
+    }
+
+    Decision admit(uint32_t ip) {
+        const size_t connectionLimit = maxConnections.load(std::memory_order_relaxed);
+        const size_t ipLimit = maxPerIp.load(std::memory_order_relaxed);
+
+        size_t current = active.fetch_add(1, std::memory_order_acq_rel);
+        if (connectionLimit > 0 && current >= connectionLimit) {
+            active.fetch_sub(1, std::memory_order_acq_rel);
+            return Decision::RejectServerFull;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(ipMtx);
+            size_t& count = perIp[ip];
+            if (ipLimit > 0 && count >= ipLimit) {
+                active.fetch_sub(1, std::memory_order_acq_rel);
+                return Decision::RejectIpLimit;
+            }
+            ++count;
+        }
+
+        return Decision::Admit;
+    }
+
+    void release(uint32_t ip) {
+        {
+            std::lock_guard<std::mutex> lock(ipMtx);
+            auto it = perIp.find(ip);
+            if (it != perIp.end() && --it->second == 0) {
+                perIp.erase(it);
+            }
+        }
+        active.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    size_t activeConnections() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    // Full keep-alive timeout up to half load, then linearly down to the minimum
+    // at the connection cap.
+    std::chrono::milliseconds idleTimeout() const {
+        const size_t connectionLimit = maxConnections.load(std::memory_order_relaxed);
+        const std::chrono::milliseconds keepAlive(keepAliveTimeout.load(std::memory_order_relaxed));
+        const std::chrono::milliseconds minKeepAlive(minKeepAliveTimeout.load(std::memory_order_relaxed));
+
+        if (connectionLimit == 0) return keepAlive;
+
+        double load = static_cast<double>(activeConnections()) / static_cast<double>(connectionLimit);
+        if (load <= 0.5) return keepAlive;
+        if (load >= 1.0) return minKeepAlive;
+
+        double scale = (1.0 - load) / 0.5;
+        auto span = keepAlive - minKeepAlive;
+        return minKeepAlive + std::chrono::milliseconds(static_cast<long long>(span.count() * scale));
+    }
+};
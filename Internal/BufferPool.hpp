@@ -0,0 +1,65 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <vector>
+
+// Fixed-size receive buffers owned by one event loop. Connections only borrow a
+// buffer while draining a readable socket, so idle keep-alive connections cost
+// no buffer memory at all. Buffers are carved out of slabs of one allocation
+// granule, committed on the loop's NUMA node once it is pinned to one, and go
+// back to the system with the pool. Not thread-safe: use from the owning loop
+// only.
+class BufferPool {
+public:
+    static constexpr size_t BUFFER_SIZE = 16 * 1024;
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+private:
+    std::vector<char*> freeList;
+    std::vector<void*> slabs;
+    DWORD node = NUMA_NO_PREFERRED_NODE;
+
+    bool grow() {
+        void* slab = node == NUMA_NO_PREFERRED_NODE
+            ? VirtualAlloc(nullptr, SLAB_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+            : VirtualAllocExNuma(GetCurrentProcess(), nullptr, SLAB_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+        if (slab == nullptr) return false;
+
+        slabs.push_back(slab);
+        for (size_t offset = SLAB_SIZE; offset >= BUFFER_SIZE; offset -= BUFFER_SIZE) {
+            freeList.push_back(static_cast<char*>(slab) + offset - BUFFER_SIZE);
+        }
+        return true;
+    }
+
+public:
+    BufferPool() = default;
+
+    ~BufferPool() {
+        for (void* slab : slabs) {
+            VirtualFree(slab, 0, MEM_RELEASE);
+        }
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // NUMA node for slabs allocated from now on.
+    void setNode(DWORD preferred) {
+        node = preferred;
+    }
+
+    // nullptr when out of memory.
+    char* acquire() {
+        if (freeList.empty() && !grow()) return nullptr;
+
+        char* buffer = freeList.back();
+        freeList.pop_back();
+        return buffer;
+    }
+
+    void release(char* buffer) {
+        if (buffer != nullptr) freeList.push_back(buffer);
+    }
+};
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+
+// From vcpkg (vcpkg.json). Its MSBuild integration adds the include path and
+// links the right zlib/zlibd import library per configuration.
+#include <zlib.h>
+
+namespace HTTP {
+    enum class ContentEncoding {
+        Identity,
+        Gzip,
+        Deflate
+    };
+
+    inline const char* contentEncodingName(ContentEncoding encoding) {
+        switch (encoding) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Deflate: return "deflate";
+        default: return "identity";
+        }
+    }
+
+    // Picks the best encoding we support from an Accept-Encoding header value,
+    // honouring q-values ("gzip;q=0" disables gzip, "*" matches anything).
+    inline ContentEncoding negotiateEncoding(const std::string& acceptEncoding) {
+        double gzipQ = -1.0;
+        double deflateQ = -1.0;
+        double wildcardQ = 0.0;
+
+        std::stringstream ss(acceptEncoding);
+        std::string item;
+        while (std::getline(ss, item, ',')) {
+            std::string token = item;
+            double q = 1.0;
+
+            size_t semi = item.find(';');
+            if (semi != std::string::npos) {
+                token = item.substr(0, semi);
+                size_t qPos = item.find("q=", semi);
+                if (qPos != std::string::npos) {
+                    try {
+                        q = std::stod(item.substr(qPos + 2));
+                    } catch (...) {
+                        q = 0.0;
+                    }
+                }
+            }
+
+            token.erase(0, token.find_first_not_of(" \t"));
+            token.erase(token.find_last_not_of(" \t") + 1);
+            std::transform(token.begin(), token.end(), token.begin(), ::tolower);
+
+            if (token == "gzip" || token == "x-gzip") gzipQ = q;
+            else if (token == "deflate") deflateQ = q;
+            else if (token == "*") wildcardQ = q;
+        }
+
+        if (gzipQ < 0.0) gzipQ = wildcardQ;
+        if (deflateQ < 0.0) deflateQ = wildcardQ;
+
+        if (gzipQ <= 0.0 && deflateQ <= 0.0) return ContentEncoding::Identity;
+        return gzipQ >= deflateQ ? ContentEncoding::Gzip : ContentEncoding::Deflate;
+    }
+
+    inline bool isCompressibleType(const std::string& contentType) {
+        std::string type = contentType.substr(0, contentType.find(';'));
+        std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+
+        if (type.rfind("text/", 0) == 0) return true;
+        if (type.size() > 5 && (type.compare(type.size() - 5, 5, "+json") == 0 || type.compare(type.size() - 4, 4, "+xml") == 0)) return true;
+
+        return type == "application/json"
+            || type == "application/javascript"
+            || type == "application/xml"
+            || type == "image/svg+xml";
+    }
+
+    // Deflate context. deflateInit2 allocates ~256 KB of state, so each worker
+    // keeps one stream per encoding alive and only resets it between bodies.
+    // A body compressed across co_await (a streamed response) owns its own
+    // Compressor instead, since another response may use the thread's meanwhile.
+    class Compressor {
+    private:
+        z_stream stream{};
+        ContentEncoding encoding;
+        int level;
+        bool initialized = false;
+
+    public:
+        explicit Compressor(ContentEncoding encoding) : encoding(encoding), level(Z_DEFAULT_COMPRESSION) {}
+
+        Compressor(const Compressor&) = delete;
+        Compressor& operator=(const Compressor&) = delete;
+
+        ~Compressor() {
+            if (initialized) deflateEnd(&stream);
+        }
+
+        static Compressor& forThread(ContentEncoding encoding) {
+            thread_local Compressor gzip(ContentEncoding::Gzip);
+            thread_local Compressor deflate(ContentEncoding::Deflate);
+            return encoding == ContentEncoding::Gzip ? gzip : deflate;
+        }
+
+        // Starts a new compressed body. Call update() for every piece of input and
+        // pass finish = true with the last one; each piece is flushed so it can
+        // be sent as soon as it is compressed.
+        bool begin(int compressionLevel) {
+            if (!initialized) {
+                // 15 window bits = zlib wrapper ("deflate"), +16 = gzip wrapper.
+                int windowBits = encoding == ContentEncoding::Gzip ? 15 + 16 : 15;
+                if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    return false;
+                }
+                initialized = true;
+                level = compressionLevel;
+                return true;
+            }
+
+            if (deflateReset(&stream) != Z_OK) return false;
+            if (compressionLevel != level) {
+                if (deflateParams(&stream, compressionLevel, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+                level = compressionLevel;
+            }
+            return true;
+        }
+
+        bool update(const char* data, size_t size, std::string& out, bool finish) {
+            stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+            stream.avail_in = static_cast<uInt>(size);
+
+            char chunk[16 * 1024];
+            int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+            int result;
+            do {
+                stream.next_out = reinterpret_cast<Bytef*>(chunk);
+                stream.avail_out = sizeof(chunk);
+
+                result = deflate(&stream, flush);
+                if (result == Z_STREAM_ERROR) return false;
+
+                out.append(chunk, sizeof(chunk) - stream.avail_out);
+            } while (stream.avail_out == 0 || (finish && result != Z_STREAM_END));
+
+            return true;
+        }
+
+        bool compress(const std::string& in, std::string& out, int compressionLevel) {
+            out.clear();
+            out.reserve(in.size() / 3);
+            return begin(compressionLevel) && update(in.data(), in.size(), out, true);
+        }
+    };
+
+    // Caps how many workers may be compressing at once so large bodies cannot
+    // starve request handling; over budget we simply send the body uncompressed.
+    class CompressionBudget {
+    private:
+        inline static std::atomic<int> inFlight{ 0 };
+        bool acquired = false;
+
+    public:
+        explicit CompressionBudget(int limit) {
+            int current = inFlight.load(std::memory_order_relaxed);
+            while (current < limit) {
+                if (inFlight.compare_exchange_weak(current, current + 1, std::memory_order_acquire)) {
+                    acquired = true;
+                    break;
+                }
+            }
+        }
+
+        ~CompressionBudget() {
+            if (acquired) inFlight.fetch_sub(1, std::memory_order_release);
+        }
+
+        CompressionBudget(const CompressionBudget&) = delete;
+        CompressionBudget& operator=(const CompressionBudget&) = delete;
+
+        explicit operator bool() const {
+            return acquired;
+        }
+    };
+}
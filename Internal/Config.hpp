@@ -1,32 +1,315 @@
 #pragma once
 
+#include <WinSock2.h>
+#include <Windows.h>
+#include <atomic>
+#include <filesystem>
+#include <functional>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
+// One reverse-proxy upstream pool ("upstreams" in config.json).
+struct UpstreamSettings {
+    std::vector<std::string> servers;           // "host:port"
+    std::string balance = "round-robin";        // or "least-connections"
+    int         maxIdle = 32;                   // idle keep-alive connections per loop and server
+    int         connectTimeout = 2000;
+    int         readTimeout = 30000;
+    std::string healthPath;                     // empty: no active health checks
+    int         healthInterval = 5000;
+    int         healthTimeout = 2000;
+
+    bool operator==(const UpstreamSettings&) const = default;
+};
+
+// Every tuning knob, as one immutable snapshot. Defaults match config.json.
+struct Settings {
+    std::string host = "127.0.0.1";
+    int         port = 8080;
+    int         backlog = 512;
+    int         threads = 4;
+    size_t      maxRequestSize = 16 * 1024;
+    std::string publicPath = "public";
+    size_t      maxUploadSize = 64 * 1024 * 1024;
+    std::string uploadPath = "uploads";
+
+    bool        compressionEnabled = true;
+    int         compressionLevel = 6;
+    size_t      compressionMinSize = 1024;
+    int         compressionWorkers = 2;
+
+    int         maxConnections = 10000;
+    int         maxConnectionsPerIp = 64;
+    int         headerTimeout = 5000;
+    int         bodyTimeout = 30000;
+    int         writeTimeout = 30000;
+    int         keepAliveTimeout = 5000;
+    int         minKeepAliveTimeout = 250;
+    int         drainTimeout = 30000;
+
+    std::string ioBackend = "acceptex";
+    int         ioBatchSize = 64;
+    int         ioAcceptDepth = 16;
+
+    std::string cpuAffinity = "none";           // "none", "compact" or "spread"
+    std::vector<int> cpuList;                   // explicit logical processors, overrides cpuAffinity
+    bool        cpuNumaLocalMemory = true;
+
+    bool        http2Enabled = true;
+    int         http2MaxConcurrentStreams = 256;
+    int         http2InitialWindowSize = 65535;
+
+    size_t      webSocketMaxMessageSize = 65536;
+    int         webSocketMaxQueuedFrames = 1024;
+    int         webSocketPingInterval = 30000;
+
+    bool        tlsEnabled = false;
+    std::string tlsCertificateSubject = "localhost";
+    std::string tlsCertificateStore = "CurrentUser";
+
+    std::map<std::string, UpstreamSettings> upstreams;
+
+    // j.value() converts numbers with a plain cast, so -1 would become a huge
+    // size_t limit. Integer settings must be whole numbers that fit their type.
+    template <typename T>
+    static T toInteger(const json& value, const std::string& name) {
+        if (value.is_number_unsigned()) {
+            uint64_t number = value.get<uint64_t>();
+            if (number <= static_cast<uint64_t>(std::numeric_limits<T>::max())) return static_cast<T>(number);
+        } else if (value.is_number_integer()) {
+            int64_t number = value.get<int64_t>();
+            if (number >= static_cast<int64_t>(std::numeric_limits<T>::min()) &&
+                (number < 0 || static_cast<uint64_t>(number) <= static_cast<uint64_t>(std::numeric_limits<T>::max()))) {
+                return static_cast<T>(number);
+            }
+        } else {
+            throw std::invalid_argument(name + " must be an integer.");
+        }
+        throw std::out_of_range(name + " is out of range.");
+    }
+
+    template <typename T>
+    static T integer(const json& j, const std::string& section, const char* key, T fallback) {
+        auto found = j.find(key);
+        if (found == j.end()) return fallback;
+        return toInteger<T>(*found, section.empty() ? std::string(key) : section + "." + key);
+    }
+
+    // Fills settings from j; missing keys keep their defaults. Returns false with
+    // a message on a type error or an out-of-range value.
+    static bool fromJson(const json& j, Settings& s, std::string& error) {
+        try {
+            s.host = j.value("host", s.host);
+            s.port = integer(j, "", "port", s.port);
+            s.backlog = integer(j, "", "backlog", s.backlog);
+            s.threads = integer(j, "", "threads", s.threads);
+            s.maxRequestSize = integer(j, "", "maxRequestSize", s.maxRequestSize);
+            s.publicPath = j.value("publicPath", s.publicPath);
+            s.maxUploadSize = integer(j, "", "maxUploadSize", s.maxUploadSize);
+            s.uploadPath = j.value("uploadPath", s.uploadPath);
+
+            if (j.contains("compression")) {
+                const json& c = j["compression"];
+                s.compressionEnabled = c.value("enabled", s.compressionEnabled);
+                s.compressionLevel = integer(c, "compression", "level", s.compressionLevel);
+                s.compressionMinSize = integer(c, "compression", "minSize", s.compressionMinSize);
+                s.compressionWorkers = integer(c, "compression", "workers", s.compressionWorkers);
+            }
+
+            if (j.contains("limits")) {
+                const json& l = j["limits"];
+                s.maxConnections = integer(l, "limits", "maxConnections", s.maxConnections);
+                s.maxConnectionsPerIp = integer(l, "limits", "maxConnectionsPerIp", s.maxConnectionsPerIp);
+                s.headerTimeout = integer(l, "limits", "headerTimeout", s.headerTimeout);
+                s.bodyTimeout = integer(l, "limits", "bodyTimeout", s.bodyTimeout);
+                s.writeTimeout = integer(l, "limits", "writeTimeout", s.writeTimeout);
+                s.keepAliveTimeout = integer(l, "limits", "keepAliveTimeout", s.keepAliveTimeout);
+                s.minKeepAliveTimeout = integer(l, "limits", "minKeepAliveTimeout", s.minKeepAliveTimeout);
+                s.drainTimeout = integer(l, "limits", "drainTimeout", s.drainTimeout);
+            }
+
+            if (j.contains("io")) {
+                const json& io = j["io"];
+                s.ioBackend = io.value("backend", s.ioBackend);
+                s.ioBatchSize = integer(io, "io", "batchSize", s.ioBatchSize);
+                s.ioAcceptDepth = integer(io, "io", "acceptDepth", s.ioAcceptDepth);
+            }
+
+            if (j.contains("cpu")) {
+                const json& c = j["cpu"];
+                s.cpuAffinity = c.value("affinity", s.cpuAffinity);
+                if (c.contains("cpus")) {
+                    if (!c["cpus"].is_array()) throw std::invalid_argument("cpu.cpus must be an array.");
+                    s.cpuList.clear();
+                    for (const json& cpu : c["cpus"]) s.cpuList.push_back(toInteger<int>(cpu, "cpu.cpus"));
+                }
+                s.cpuNumaLocalMemory = c.value("numaLocalMemory", s.cpuNumaLocalMemory);
+            }
+
+            if (j.contains("http2")) {
+                const json& h = j["http2"];
+                s.http2Enabled = h.value("enabled", s.http2Enabled);
+                s.http2MaxConcurrentStreams = integer(h, "http2", "maxConcurrentStreams", s.http2MaxConcurrentStreams);
+                s.http2InitialWindowSize = integer(h, "http2", "initialWindowSize", s.http2InitialWindowSize);
+            }
+
+            if (j.contains("websocket")) {
+                const json& w = j["websocket"];
+                s.webSocketMaxMessageSize = integer(w, "websocket", "maxMessageSize", s.webSocketMaxMessageSize);
+                s.webSocketMaxQueuedFrames = integer(w, "websocket", "maxQueuedFrames", s.webSocketMaxQueuedFrames);
+                s.webSocketPingInterval = integer(w, "websocket", "pingInterval", s.webSocketPingInterval);
+            }
+
+            if (j.contains("tls")) {
+                const json& t = j["tls"];
+                s.tlsEnabled = t.value("enabled", s.tlsEnabled);
+                s.tlsCertificateSubject = t.value("certificateSubject", s.tlsCertificateSubject);
+                s.tlsCertificateStore = t.value("certificateStore", s.tlsCertificateStore);
+            }
+
+            if (j.contains("upstreams")) {
+                for (const auto& [name, u] : j["upstreams"].items()) {
+                    const std::string section = "upstreams." + name;
+                    UpstreamSettings upstream;
+                    upstream.servers = u.value("servers", upstream.servers);
+                    upstream.balance = u.value("balance", upstream.balance);
+                    upstream.maxIdle = integer(u, section, "maxIdle", upstream.maxIdle);
+                    upstream.connectTimeout = integer(u, section, "connectTimeout", upstream.connectTimeout);
+                    upstream.readTimeout = integer(u, section, "readTimeout", upstream.readTimeout);
+                    if (u.contains("healthCheck")) {
+                        const json& h = u["healthCheck"];
+                        upstream.healthPath = h.value("path", upstream.healthPath);
+                        upstream.healthInterval = integer(h, section + ".healthCheck", "interval", upstream.healthInterval);
+                        upstream.healthTimeout = integer(h, section + ".healthCheck", "timeout", upstream.healthTimeout);
+                    }
+                    s.upstreams[name] = upstream;
+                }
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+            return false;
+        }
+
+        return s.validate(error);
+    }
+
+    bool validate(std::string& error) const {
+        auto fail = [&error](const std::string& message) {
+            error = message;
+            return false;
+        };
+
+        if (port < 1 || port > 65535) return fail("port must be between 1 and 65535.");
+        if (backlog < 1) return fail("backlog must be positive.");
+        if (threads < 1 || threads > 256) return fail("threads must be between 1 and 256.");
+        if (maxRequestSize < 1024) return fail("maxRequestSize must be at least 1024.");
+        if (maxUploadSize < maxRequestSize) return fail("maxUploadSize must not be below maxRequestSize.");
+        if (compressionLevel < 0 || compressionLevel > 9) return fail("compression.level must be between 0 and 9.");
+        if (compressionWorkers < 1) return fail("compression.workers must be positive.");
+        if (maxConnections < 0 || maxConnectionsPerIp < 0) return fail("limits.maxConnections and limits.maxConnectionsPerIp must not be negative.");
+        if (headerTimeout <= 0 || bodyTimeout <= 0 || writeTimeout <= 0 || drainTimeout <= 0) return fail("limits timeouts must be positive.");
+        if (minKeepAliveTimeout <= 0 || minKeepAliveTimeout > keepAliveTimeout) return fail("limits.minKeepAliveTimeout must be positive and not above limits.keepAliveTimeout.");
+        if (ioBackend != "acceptex" && ioBackend != "eventselect") return fail("Unknown io.backend '" + ioBackend + "', expected 'acceptex' or 'eventselect'.");
+        if (ioBatchSize < 1 || ioAcceptDepth < 1) return fail("io.batchSize and io.acceptDepth must be positive.");
+        if (cpuAffinity != "none" && cpuAffinity != "compact" && cpuAffinity != "spread") return fail("Unknown cpu.affinity '" + cpuAffinity + "', expected 'none', 'compact' or 'spread'.");
+        for (int cpu : cpuList) {
+            if (cpu < 0) return fail("cpu.cpus must not contain negative processor numbers.");
+        }
+        if (http2MaxConcurrentStreams < 1) return fail("http2.maxConcurrentStreams must be positive.");
+        if (http2InitialWindowSize < 65535) return fail("http2.initialWindowSize must be at least 65535.");
+        if (webSocketMaxMessageSize == 0 || webSocketMaxQueuedFrames < 1) return fail("websocket.maxMessageSize and websocket.maxQueuedFrames must be positive.");
+        if (webSocketPingInterval < 0) return fail("websocket.pingInterval must not be negative.");
+        if (tlsCertificateStore != "CurrentUser" && tlsCertificateStore != "LocalMachine") return fail("Unknown tls.certificateStore '" + tlsCertificateStore + "', expected 'CurrentUser' or 'LocalMachine'.");
+
+        for (const auto& [name, upstream] : upstreams) {
+            const std::string prefix = "upstreams." + name;
+            if (upstream.servers.empty()) return fail(prefix + ".servers must not be empty.");
+            for (const std::string& server : upstream.servers) {
+                size_t colon = server.rfind(':');
+                if (colon == std::string::npos || colon == 0 || server.find_first_not_of("0123456789", colon + 1) != std::string::npos || colon + 1 == server.size()) {
+                    return fail(prefix + ": '" + server + "' is not host:port.");
+                }
+            }
+            if (upstream.balance != "round-robin" && upstream.balance != "least-connections") return fail("Unknown " + prefix + ".balance '" + upstream.balance + "', expected 'round-robin' or 'least-connections'.");
+            if (upstream.maxIdle < 0) return fail(prefix + ".maxIdle must not be negative.");
+            if (upstream.connectTimeout <= 0 || upstream.readTimeout <= 0 || upstream.healthInterval <= 0 || upstream.healthTimeout <= 0) return fail(prefix + " timeouts must be positive.");
+        }
+
+        return true;
+    }
+
+    // Settings bound to the listener and threads at startup.
+    std::vector<std::string> restartRequired(const Settings& other) const {
+        std::vector<std::string> changed;
+        if (host != other.host || port != other.port) changed.push_back("host/port");
+        if (backlog != other.backlog) changed.push_back("backlog");
+        if (threads != other.threads) changed.push_back("threads");
+        if (ioBackend != other.ioBackend || ioBatchSize != other.ioBatchSize || ioAcceptDepth != other.ioAcceptDepth) changed.push_back("io");
+        if (cpuAffinity != other.cpuAffinity || cpuList != other.cpuList || cpuNumaLocalMemory != other.cpuNumaLocalMemory) changed.push_back("cpu");
+        if (tlsEnabled != other.tlsEnabled || tlsCertificateSubject != other.tlsCertificateSubject || tlsCertificateStore != other.tlsCertificateStore) changed.push_back("tls");
+        if (http2Enabled != other.http2Enabled && tlsEnabled) changed.push_back("http2.enabled (ALPN)");
+        if (upstreams != other.upstreams) changed.push_back("upstreams");
+        return changed;
+    }
+};
+
+// Owns the active Settings snapshot. Reloads build a new snapshot and publish it
+// with a version bump (RCU-style): readers keep a per-thread reference and only
+// take the lock when the version moved, so the hot path is one atomic load.
+// Old snapshots are freed once the last thread or connection drops them.
 class Config {
 private:
     Config() = default;
 
     Config(const Config&) = delete;
     Config& operator=(const Config&) = delete;
-public:
-    std::string host = "127.0.0.1";
-    int         port = 8080;
 
-    static Config& getInstance() {
-        static Config instance;
-        return instance;
+    std::mutex mtx;
+    std::shared_ptr<const Settings> active = std::make_shared<Settings>();
+    std::atomic<uint64_t> version{ 1 };
+    std::filesystem::path path;
+    std::map<int, std::function<void(const Settings&)>> listeners;
+    int nextListener = 0;
+
+    std::thread watcher;
+    HANDLE stopEvent = nullptr;
+
+    struct ThreadCache {
+        uint64_t version = 0;
+        std::shared_ptr<const Settings> settings;
+    };
+
+    static ThreadCache& cache() {
+        thread_local ThreadCache local;
+        return local;
+    }
+
+    ThreadCache& refresh() {
+        ThreadCache& local = cache();
+        if (local.version != version.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(mtx);
+            local.settings = active;
+            local.version = version.load(std::memory_order_relaxed);
+        }
+        return local;
     }
 
-    inline bool loadFile(const std::string& path) {
+    bool load(std::shared_ptr<const Settings>& out) {
         std::ifstream in(path);
 
         if (!in.is_open()) {
-            std::cerr << "[!] [Config] Unable to load config.json." << std::endl;
+            std::cerr << "[!] [Config] Unable to load " << path.filename().string() << "." << std::endl;
             return false;
         }
 
@@ -39,13 +322,174 @@ public:
             return false;
         }
 
-        host = j.value("host", "127.0.0.1");
-        port = j.value("port", 8080);
+        auto settings = std::make_shared<Settings>();
+        std::string error;
+        if (!Settings::fromJson(j, *settings, error)) {
+            std::cerr << "[!] [Config] " << error << std::endl;
+            return false;
+        }
+
+        // Relative paths are resolved against the config file's directory.
+        for (std::string* setting : { &settings->publicPath, &settings->uploadPath }) {
+            std::filesystem::path relative(*setting);
+            if (relative.is_relative()) {
+                *setting = (path.parent_path() / relative).string();
+            }
+        }
+
+        out = std::move(settings);
+        return true;
+    }
+
+    void watchLoop() {
+        std::filesystem::path directory = path.parent_path();
+        HANDLE change = FindFirstChangeNotificationW(directory.wstring().c_str(), FALSE,
+            FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+        if (change == INVALID_HANDLE_VALUE) {
+            std::cerr << "[!] [Config] Unable to watch " << directory.string() << ": " << GetLastError() << std::endl;
+            return;
+        }
+
+        std::error_code ec;
+        auto lastWrite = std::filesystem::last_write_time(path, ec);
+        HANDLE handles[2] = { change, stopEvent };
+
+        while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0) {
+            // Editors save in several steps; let the file settle first.
+            Sleep(200);
+            FindNextChangeNotification(change);
+
+            auto current = std::filesystem::last_write_time(path, ec);
+            if (ec || current == lastWrite) continue;
+            lastWrite = current;
+
+            reload();
+        }
+
+        FindCloseChangeNotification(change);
+    }
+
+public:
+    static Config& getInstance() {
+        static Config instance;
+        return instance;
+    }
+
+    ~Config() {
+        stopWatching();
+    }
+
+    // The calling thread's snapshot, refreshed when a reload has been published.
+    // Holding it pins that snapshot, e.g. for the lifetime of a request or
+    // across a co_await; a reload never changes it underneath.
+    static std::shared_ptr<const Settings> current() {
+        return getInstance().refresh().settings;
+    }
+
+    inline bool loadFile(const std::string& file) {
+        path = std::filesystem::absolute(file);
 
+        std::shared_ptr<const Settings> loaded;
+        if (!load(loaded)) return false;
+
+        std::lock_guard<std::mutex> lock(mtx);
+        active = std::move(loaded);
+        version.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+
+    // Re-reads the file; on any error the running snapshot stays in place.
+    bool reload() {
+        std::shared_ptr<const Settings> loaded;
+        if (!load(loaded)) {
+            std::cerr << "[!] [Config] Reload failed, keeping the current configuration." << std::endl;
+            return false;
+        }
+
+        std::vector<std::function<void(const Settings&)>> notify;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (const std::string& name : active->restartRequired(*loaded)) {
+                std::cout << "[!] [Config] Change to " << name << " takes effect after a restart." << std::endl;
+            }
+            active = loaded;
+            version.fetch_add(1, std::memory_order_release);
+            for (const auto& [id, listener] : listeners) {
+                notify.push_back(listener);
+            }
+        }
+
+        for (auto& listener : notify) {
+            listener(*loaded);
+        }
+
+        std::cout << "[*] [Config] Reloaded " << path.filename().string() << "." << std::endl;
         return true;
     }
 
+    // Called after every successful reload, for state built from settings at
+    // startup. Returns an id for removeListener().
+    int onReload(std::function<void(const Settings&)> listener) {
+        std::lock_guard<std::mutex> lock(mtx);
+        listeners[nextListener] = std::move(listener);
+        return nextListener++;
+    }
+
+    void removeListener(int id) {
+        std::lock_guard<std::mutex> lock(mtx);
+        listeners.erase(id);
+    }
+
+    void watch() {
+        if (watcher.joinable()) return;
+
+        stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        watcher = std::thread(&Config::watchLoop, this);
+    }
+
+    void stopWatching() {
+        if (!watcher.joinable()) return;
+
+        SetEvent(stopEvent);
+        watcher.join();
+        CloseHandle(stopEvent);
+        stopEvent = nullptr;
+    }
+
     inline void outputConfig() {
-        std::cout << "[*] [Config] Using hostname " << host << ":" << port << "." << std::endl;
+        std::shared_ptr<const Settings> settings = current();
+        const Settings& s = *settings;
+
+        std::cout << "[*] [Config] Using hostname " << s.host << ":" << s.port << " with a listen backlog of " << s.backlog << " and " << s.threads << " event loops." << std::endl;
+        std::cout << "[*] [Config] Requests up to " << s.maxRequestSize << " bytes, public files from " << s.publicPath << "." << std::endl;
+        std::cout << "[*] [Config] Uploads up to " << s.maxUploadSize << " bytes, stored in " << s.uploadPath << "." << std::endl;
+        if (s.compressionEnabled) {
+            std::cout << "[*] [Config] Compression level " << s.compressionLevel << " for bodies >= " << s.compressionMinSize << " bytes, " << s.compressionWorkers << " concurrent." << std::endl;
+        } else {
+            std::cout << "[*] [Config] Compression disabled." << std::endl;
+        }
+        std::cout << "[*] [Config] Limits: " << s.maxConnections << " connections, " << s.maxConnectionsPerIp << " per IP, keep-alive " << s.minKeepAliveTimeout << "-" << s.keepAliveTimeout << " ms." << std::endl;
+        std::cout << "[*] [Config] Deadlines: headers " << s.headerTimeout << " ms, body " << s.bodyTimeout << " ms, write " << s.writeTimeout << " ms, drain " << s.drainTimeout << " ms." << std::endl;
+        std::cout << "[*] [Config] I/O backend " << s.ioBackend << ", " << s.ioBatchSize << " completions per wait";
+        if (s.ioBackend == "acceptex") std::cout << ", " << s.ioAcceptDepth << " pending accepts";
+        std::cout << "." << std::endl;
+        if (!s.cpuList.empty()) {
+            std::cout << "[*] [Config] Event loops pinned to " << s.cpuList.size() << " listed processors";
+        } else {
+            std::cout << "[*] [Config] CPU affinity " << s.cpuAffinity;
+        }
+        std::cout << (s.cpuNumaLocalMemory ? ", NUMA-local buffers and frames." : ".") << std::endl;
+        if (s.http2Enabled) {
+            std::cout << "[*] [Config] HTTP/2 enabled, " << s.http2MaxConcurrentStreams << " concurrent streams, " << s.http2InitialWindowSize << " byte windows." << std::endl;
+        }
+        std::cout << "[*] [Config] WebSocket messages up to " << s.webSocketMaxMessageSize << " bytes, " << s.webSocketMaxQueuedFrames << " queued frames, ping every " << s.webSocketPingInterval << " ms." << std::endl;
+        if (s.tlsEnabled) {
+            std::cout << "[*] [Config] TLS enabled with certificate '" << s.tlsCertificateSubject << "' from the " << s.tlsCertificateStore << " store." << std::endl;
+        }
+        for (const auto& [name, upstream] : s.upstreams) {
+            std::cout << "[*] [Config] Upstream " << name << ": " << upstream.servers.size() << " servers, " << upstream.balance;
+            if (!upstream.healthPath.empty()) std::cout << ", health check " << upstream.healthPath << " every " << upstream.healthInterval << " ms";
+            std::cout << "." << std::endl;
+        }
     }
-};
\ No newline at end of file
+};
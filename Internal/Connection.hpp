@@ -0,0 +1,47 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <memory>
+#include <string>
+
+#include "EventLoop.hpp"
+#include "Tls.hpp"
+
+// A client socket pinned to its event loop, plus the optional TLS layer.
+// Protocol handlers read and write through it without caring whether the
+// bytes on the wire are encrypted.
+class Connection {
+public:
+    EventLoop& loop;
+    SOCKET socket;
+    sockaddr_in address;
+    std::string ip;
+    Deadline deadline;
+    std::unique_ptr<TlsSession> tls;
+
+    Connection(EventLoop& loop, SOCKET socket, const sockaddr_in& address)
+        : loop(loop), socket(socket), address(address), deadline(loop, socket) {
+        char text[INET_ADDRSTRLEN] = {};
+        inet_ntop(AF_INET, &address.sin_addr, text, INET_ADDRSTRLEN);
+        ip = text;
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    // Appends received (decrypted) bytes to out: >0 bytes, 0 on close, -1 on error.
+    Task<int> receive(std::string& out) {
+        if (tls) co_return co_await tls->receive(loop, socket, out);
+        co_return co_await loop.receive(socket, out);
+    }
+
+    Task<bool> send(const std::string& head, const std::string& body) {
+        if (tls) co_return co_await tls->sendAll(loop, socket, head, body);
+        co_return co_await loop.sendAll(socket, head, body);
+    }
+
+    Task<void> shutdown() {
+        if (tls) co_await tls->shutdown(loop, socket);
+    }
+};
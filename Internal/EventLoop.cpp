@@ -0,0 +1,351 @@
+#include <WinSock2.h>
+#include <iostream>
+#include <stdexcept>
+
+#include "EventLoop.hpp"
+#include "Topology.hpp"
+
+namespace {
+    thread_local EventLoop* currentLoop = nullptr;
+}
+
+EventLoop::EventLoop(int batchSize) : batchSize(batchSize > 0 ? static_cast<ULONG>(batchSize) : 1) {
+    iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+    if (iocp == nullptr) {
+        throw std::runtime_error("CreateIoCompletionPort failed");
+    }
+
+    static const bool ifsOnly = ifsProvidersOnly();
+    skipOnSuccess = ifsOnly;
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    CloseHandle(iocp);
+}
+
+void EventLoop::place(const CpuSlot& slot, bool localMemory) {
+    affinity = GROUP_AFFINITY{};
+    affinity.Group = slot.group;
+    affinity.Mask = static_cast<KAFFINITY>(1) << slot.number;
+    pinned = true;
+
+    if (localMemory) {
+        buffers.setNode(slot.node);
+        frames.setNode(slot.node);
+    }
+}
+
+void EventLoop::start() {
+    thread = std::thread(&EventLoop::loop, this);
+}
+
+void EventLoop::stop() {
+    if (!thread.joinable()) return;
+
+    PostQueuedCompletionStatus(iocp, 0, KeyStop, nullptr);
+    thread.join();
+}
+
+bool EventLoop::ifsProvidersOnly() {
+    // Skipping completion packets is only safe when no layered (non-IFS) provider
+    // sits on the TCP stack.
+    DWORD size = 0;
+    WSAEnumProtocolsW(nullptr, nullptr, &size);
+    if (size == 0) return false;
+
+    std::vector<char> buffer(size);
+    auto* protocols = reinterpret_cast<WSAPROTOCOL_INFOW*>(buffer.data());
+    int count = WSAEnumProtocolsW(nullptr, protocols, &size);
+    if (count == SOCKET_ERROR) return false;
+
+    for (int i = 0; i < count; ++i) {
+        if (protocols[i].iProtocol == IPPROTO_TCP && !(protocols[i].dwServiceFlags1 & XP1_IFS_HANDLES)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EventLoop::attach(HANDLE handle) {
+    if (CreateIoCompletionPort(handle, iocp, KeyIo, 0) != iocp) return false;
+
+    if (skipOnSuccess) {
+        SetFileCompletionNotificationModes(handle, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS | FILE_SKIP_SET_EVENT_ON_HANDLE);
+    }
+    return true;
+}
+
+void EventLoop::post(std::function<void()> fn) {
+    auto* posted = new std::function<void()>(std::move(fn));
+    if (!PostQueuedCompletionStatus(iocp, 0, KeyPost, reinterpret_cast<LPOVERLAPPED>(posted))) {
+        delete posted;
+        std::cerr << "[!] [EventLoop] PostQueuedCompletionStatus failed: " << GetLastError() << std::endl;
+    }
+}
+
+EventLoop* EventLoop::current() {
+    return currentLoop;
+}
+
+DWORD EventLoop::nextTimeout() const {
+    auto wait = timers.nextTimeout();
+    if (wait == std::chrono::milliseconds::max()) return INFINITE;
+    return static_cast<DWORD>(wait.count());
+}
+
+void EventLoop::loop() {
+    currentLoop = this;
+
+    // Pinned before anything is allocated, so the loop's own memory is first
+    // touched from its processor.
+    if (pinned && !SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr)) {
+        std::cerr << "[!] [EventLoop] SetThreadGroupAffinity failed: " << GetLastError() << std::endl;
+    }
+    FramePool::bind(&frames);
+
+    std::vector<OVERLAPPED_ENTRY> entries(batchSize);
+    bool running = true;
+
+    while (running) {
+        ULONG count = 0;
+        if (!GetQueuedCompletionStatusEx(iocp, entries.data(), batchSize, &count, nextTimeout(), FALSE)) {
+            if (GetLastError() != WAIT_TIMEOUT) {
+                std::cerr << "[!] [EventLoop] GetQueuedCompletionStatusEx failed: " << GetLastError() << std::endl;
+            }
+            timers.advance();
+            continue;
+        }
+
+        for (ULONG i = 0; i < count; ++i) {
+            const OVERLAPPED_ENTRY& entry = entries[i];
+
+            if (entry.lpCompletionKey == KeyStop) {
+                running = false;
+            } else if (entry.lpCompletionKey == KeyPost) {
+                auto* posted = reinterpret_cast<std::function<void()>*>(entry.lpOverlapped);
+                try {
+                    (*posted)();
+                } catch (const std::exception& e) {
+                    std::cerr << "[!] [EventLoop] Posted task threw: " << e.what() << std::endl;
+                }
+                delete posted;
+            } else if (entry.lpOverlapped != nullptr) {
+                auto* op = static_cast<IoOperation*>(entry.lpOverlapped);
+                op->bytesTransferred = entry.dwNumberOfBytesTransferred;
+                op->error = 0;
+
+                // Internal holds the NTSTATUS; let the system map it to a Win32 code.
+                if (op->Internal != 0) {
+                    DWORD bytes = 0;
+                    if (!GetOverlappedResult(op->target, op, &bytes, FALSE)) {
+                        op->error = GetLastError();
+                    }
+                }
+                op->handle.resume();
+            }
+        }
+
+        timers.advance();
+    }
+
+    currentLoop = nullptr;
+}
+
+bool EventLoop::suspendIfPending(IoOperation& op, bool issued, int error) {
+    if (!issued) {
+        if (error == WSA_IO_PENDING) return true;
+        op.error = error;
+        return false;
+    }
+
+    if (!skipOnSuccess) return true;
+
+    // Completed inline and no packet will be queued: collect the result now.
+    DWORD bytes = 0;
+    if (!GetOverlappedResult(op.target, &op, &bytes, FALSE)) {
+        op.error = GetLastError();
+    }
+    op.bytesTransferred = bytes;
+    return false;
+}
+
+bool EventLoop::SocketAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    op.handle = handle;
+    op.target = reinterpret_cast<HANDLE>(socket);
+
+    DWORD flags = 0;
+    int result = isSend
+        ? WSASend(socket, buffers, bufferCount, nullptr, 0, &op, nullptr)
+        : WSARecv(socket, buffers, bufferCount, nullptr, &flags, &op, nullptr);
+
+    if (!loop.suspendIfPending(op, result == 0, result == 0 ? 0 : WSAGetLastError())) {
+        return false;
+    }
+
+    if (timeout.count() > 0) {
+        SOCKET s = socket;
+        IoOperation* pending = &op;
+        timer.callback = [s, pending]() {
+            CancelIoEx(reinterpret_cast<HANDLE>(s), pending);
+        };
+        loop.schedule(timer, timeout);
+    }
+
+    return true;
+}
+
+int EventLoop::SocketAwaiter::await_resume() {
+    loop.cancel(timer);
+    if (op.error != 0) {
+        WSASetLastError(static_cast<int>(op.error));
+        return -1;
+    }
+    return static_cast<int>(op.bytesTransferred);
+}
+
+Task<bool> EventLoop::sendAll(SOCKET socket, const std::string& head, const std::string& body, std::chrono::milliseconds timeout) {
+    size_t headSent = 0;
+    size_t bodySent = 0;
+
+    while (headSent < head.size() || bodySent < body.size()) {
+        int sent;
+        if (headSent < head.size()) {
+            sent = co_await send(socket, head.data() + headSent, head.size() - headSent, body.data() + bodySent, body.size() - bodySent, timeout);
+        } else {
+            sent = co_await send(socket, body.data() + bodySent, body.size() - bodySent, timeout);
+        }
+        if (sent <= 0) co_return false;
+
+        size_t fromHead = std::min(static_cast<size_t>(sent), head.size() - headSent);
+        headSent += fromHead;
+        bodySent += sent - fromHead;
+    }
+    co_return true;
+}
+
+Task<int> EventLoop::receive(SOCKET socket, std::string& out, std::chrono::milliseconds timeout) {
+    while (true) {
+        int ready = co_await recv(socket, nullptr, 0, timeout);
+        if (ready < 0) co_return -1;
+
+        char* buffer = buffers.acquire();
+        if (buffer == nullptr) co_return -1;
+
+        int total = 0;
+        int error = 0;
+        bool closed = false;
+
+        while (true) {
+            int bytesRead = ::recv(socket, buffer, static_cast<int>(BufferPool::BUFFER_SIZE), 0);
+            if (bytesRead > 0) {
+                out.append(buffer, bytesRead);
+                total += bytesRead;
+                if (bytesRead < static_cast<int>(BufferPool::BUFFER_SIZE)) break;
+                continue;
+            }
+            if (bytesRead == 0) {
+                closed = true;
+            } else if (WSAGetLastError() != WSAEWOULDBLOCK) {
+                error = WSAGetLastError();
+            }
+            break;
+        }
+
+        buffers.release(buffer);
+
+        if (total > 0) co_return total;
+        if (error != 0) co_return -1;
+        if (closed) co_return 0;
+        // Spurious wake-up: nothing to read yet, wait again.
+    }
+}
+
+bool EventLoop::AcceptAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    op.handle = handle;
+    op.target = reinterpret_cast<HANDLE>(listenSocket);
+
+    const DWORD addressSize = sizeof(sockaddr_in) + 16;
+    DWORD bytes = 0;
+    BOOL issued = acceptEx(listenSocket, acceptSocket, addresses, 0, addressSize, addressSize, &bytes, &op);
+
+    return loop.suspendIfPending(op, issued != FALSE, issued ? 0 : WSAGetLastError());
+}
+
+bool EventLoop::ConnectAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    op.handle = handle;
+    op.target = reinterpret_cast<HANDLE>(socket);
+
+    BOOL issued = connectEx(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address), nullptr, 0, nullptr, &op);
+    if (!loop.suspendIfPending(op, issued != FALSE, issued ? 0 : WSAGetLastError())) {
+        return false;
+    }
+
+    if (timeout.count() > 0) {
+        SOCKET s = socket;
+        IoOperation* pending = &op;
+        timer.callback = [s, pending]() {
+            CancelIoEx(reinterpret_cast<HANDLE>(s), pending);
+        };
+        loop.schedule(timer, timeout);
+    }
+
+    return true;
+}
+
+bool EventLoop::ConnectAwaiter::await_resume() {
+    loop.cancel(timer);
+    if (op.error != 0) return false;
+
+    // Makes getpeername, shutdown and friends work on the socket.
+    setsockopt(socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0);
+    return true;
+}
+
+bool EventLoop::FileAwaiter::await_suspend(std::coroutine_handle<> handle) {
+    op.handle = handle;
+    op.target = file;
+    op.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+    op.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    BOOL issued = isWrite ? WriteFile(file, data, size, nullptr, &op) : ReadFile(file, data, size, nullptr, &op);
+
+    return loop.suspendIfPending(op, issued != FALSE, issued ? 0 : static_cast<int>(GetLastError()));
+}
+
+int EventLoop::FileAwaiter::await_resume() const {
+    if (op.error == ERROR_HANDLE_EOF) return 0;
+    if (op.error != 0) return -1;
+    return static_cast<int>(op.bytesTransferred);
+}
+
+Task<bool> EventLoop::readFile(const std::filesystem::path& path, std::string& out) {
+    HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) co_return false;
+
+    if (!attach(file)) {
+        CloseHandle(file);
+        co_return false;
+    }
+
+    LARGE_INTEGER size{};
+    GetFileSizeEx(file, &size);
+
+    out.resize(static_cast<size_t>(size.QuadPart));
+    uint64_t offset = 0;
+    bool ok = true;
+    while (offset < out.size()) {
+        int bytesRead = co_await read(file, offset, out.data() + offset, out.size() - offset);
+        if (bytesRead < 0) {
+            ok = false;
+            break;
+        }
+        if (bytesRead == 0) break;
+        offset += bytesRead;
+    }
+    out.resize(offset);
+
+    CloseHandle(file);
+    co_return ok;
+}
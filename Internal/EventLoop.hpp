@@ -0,0 +1,275 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <MSWSock.h>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Task.hpp"
+#include "BufferPool.hpp"
+#include "TimerWheel.hpp"
+
+struct CpuSlot;
+
+// Overlapped operation whose completion resumes the coroutine waiting on it.
+struct IoOperation : OVERLAPPED {
+    std::coroutine_handle<> handle;
+    HANDLE target = nullptr;
+    DWORD bytesTransferred = 0;
+    DWORD error = 0;
+
+    IoOperation() : OVERLAPPED{} {}
+};
+
+// Single-threaded I/O completion port loop. Sockets and files attached to a loop
+// only ever complete on that loop's thread, so coroutines running on it never
+// need locking for their own state.
+//
+// Completions are drained in batches with GetQueuedCompletionStatusEx, and when
+// every installed TCP provider is IFS, handles are attached with
+// FILE_SKIP_COMPLETION_PORT_ON_SUCCESS so operations that finish inline resume
+// the coroutine immediately instead of taking a round trip through the port.
+class EventLoop {
+private:
+    enum CompletionKey : ULONG_PTR {
+        KeyIo = 0,
+        KeyPost = 1,
+        KeyStop = 2
+    };
+
+    HANDLE iocp;
+    std::thread thread;
+    ULONG batchSize;
+    bool skipOnSuccess;
+
+    BufferPool buffers;
+    FramePool frames;
+    std::atomic<size_t> connections{ 0 };
+
+    GROUP_AFFINITY affinity{};
+    bool pinned = false;
+
+    TimerWheel timers;
+
+    void loop();
+    DWORD nextTimeout() const;
+
+    static bool ifsProvidersOnly();
+
+    // Finishes an overlapped call: false (resume now) if it failed or completed
+    // inline with completion skipping enabled, true (suspend) if pending.
+    bool suspendIfPending(IoOperation& op, bool issued, int error);
+
+public:
+    using Timer = TimerWheel::Timer;
+
+    explicit EventLoop(int batchSize = 64);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Before start(): runs the loop thread on slot only and, with localMemory,
+    // takes receive buffers and coroutine frames from the slot's NUMA node.
+    void place(const CpuSlot& slot, bool localMemory);
+
+    void start();
+    void stop();
+
+    bool attach(HANDLE handle);
+    bool attach(SOCKET socket) {
+        return attach(reinterpret_cast<HANDLE>(socket));
+    }
+
+    // Thread-safe: queue fn to run on the loop thread.
+    void post(std::function<void()> fn);
+
+    // Loop thread only. Timers are owned by the caller and may be re-armed freely.
+    void schedule(Timer& timer, std::chrono::milliseconds delay) {
+        timers.schedule(timer, delay);
+    }
+    void cancel(Timer& timer) {
+        timers.cancel(timer);
+    }
+
+    static EventLoop* current();
+
+    // Live connection count, read by the acceptor to place new clients.
+    size_t connectionCount() const {
+        return connections.load(std::memory_order_relaxed);
+    }
+    void connectionOpened() {
+        connections.fetch_add(1, std::memory_order_relaxed);
+    }
+    void connectionClosed() {
+        connections.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Socket send/recv over up to two buffers. Resumes with the number of bytes
+    // transferred, 0 on orderly close, or -1 on error / timeout (a timeout of 0
+    // waits forever). After -1, WSAGetLastError() holds the completion's error:
+    // ERROR_OPERATION_ABORTED for a timeout.
+    struct SocketAwaiter {
+        EventLoop& loop;
+        SOCKET socket;
+        WSABUF buffers[2];
+        DWORD bufferCount;
+        bool isSend;
+        std::chrono::milliseconds timeout;
+
+        IoOperation op;
+        Timer timer;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        int await_resume();
+    };
+
+    SocketAwaiter recv(SOCKET socket, char* data, size_t size, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        return SocketAwaiter{ *this, socket, { { static_cast<ULONG>(size), data }, {} }, 1, false, timeout };
+    }
+
+    SocketAwaiter send(SOCKET socket, const char* data, size_t size, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        return SocketAwaiter{ *this, socket, { { static_cast<ULONG>(size), const_cast<char*>(data) }, {} }, 1, true, timeout };
+    }
+
+    // Gathered send: head and body leave in one WSASend without being concatenated.
+    SocketAwaiter send(SOCKET socket, const char* head, size_t headSize, const char* body, size_t bodySize, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        return SocketAwaiter{ *this, socket, { { static_cast<ULONG>(headSize), const_cast<char*>(head) }, { static_cast<ULONG>(bodySize), const_cast<char*>(body) } }, 2, true, timeout };
+    }
+
+    Task<bool> sendAll(SOCKET socket, const std::string& head, const std::string& body, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    // Waits for readability with a zero-byte overlapped read, then drains the
+    // (non-blocking) socket through a pooled buffer into out. Resumes with the
+    // bytes appended, 0 on orderly close, or -1 on error / timeout.
+    Task<int> receive(SOCKET socket, std::string& out, std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    struct AcceptAwaiter {
+        EventLoop& loop;
+        LPFN_ACCEPTEX acceptEx;
+        SOCKET listenSocket;
+        SOCKET acceptSocket;
+        char* addresses;
+
+        IoOperation op;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        bool await_resume() const { return op.error == 0; }
+    };
+
+    // addresses must hold 2 * (sizeof(sockaddr_in) + 16) bytes.
+    AcceptAwaiter accept(LPFN_ACCEPTEX acceptEx, SOCKET listenSocket, SOCKET acceptSocket, char* addresses) {
+        return AcceptAwaiter{ *this, acceptEx, listenSocket, acceptSocket, addresses };
+    }
+
+    // Outgoing connection with ConnectEx. The socket must be bound and attached
+    // to this loop; resumes with true once connected.
+    struct ConnectAwaiter {
+        EventLoop& loop;
+        LPFN_CONNECTEX connectEx;
+        SOCKET socket;
+        sockaddr_in address;
+        std::chrono::milliseconds timeout;
+
+        IoOperation op;
+        Timer timer;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        bool await_resume();
+    };
+
+    ConnectAwaiter connect(LPFN_CONNECTEX connectEx, SOCKET socket, const sockaddr_in& address, std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        return ConnectAwaiter{ *this, connectEx, socket, address, timeout };
+    }
+
+    struct SleepAwaiter {
+        EventLoop& loop;
+        std::chrono::milliseconds delay;
+
+        Timer timer;
+
+        bool await_ready() const noexcept { return delay.count() <= 0; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            timer.callback = [handle]() { handle.resume(); };
+            loop.schedule(timer, delay);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    SleepAwaiter sleep(std::chrono::milliseconds delay) {
+        return SleepAwaiter{ *this, delay };
+    }
+
+    // Overlapped file read or write at offset; resumes with bytes transferred
+    // (0 at EOF) or -1.
+    struct FileAwaiter {
+        EventLoop& loop;
+        HANDLE file;
+        uint64_t offset;
+        char* data;
+        DWORD size;
+        bool isWrite = false;
+
+        IoOperation op;
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle);
+        int await_resume() const;
+    };
+
+    FileAwaiter read(HANDLE file, uint64_t offset, char* data, size_t size) {
+        return FileAwaiter{ *this, file, offset, data, static_cast<DWORD>(size) };
+    }
+
+    FileAwaiter write(HANDLE file, uint64_t offset, const char* data, size_t size) {
+        return FileAwaiter{ *this, file, offset, const_cast<char*>(data), static_cast<DWORD>(size), true };
+    }
+
+    Task<bool> readFile(const std::filesystem::path& path, std::string& out);
+};
+
+// Connection-wide deadline. When it expires every pending operation on the
+// socket is cancelled, so whatever the connection is waiting on (next request,
+// rest of the headers, body, or a send) resumes with an error. Re-arming only
+// relinks the intrusive timer, so it is cheap to move between phases.
+class Deadline {
+private:
+    EventLoop& loop;
+    SOCKET socket;
+    EventLoop::Timer timer;
+    bool expired = false;
+
+public:
+    Deadline(EventLoop& loop, SOCKET socket) : loop(loop), socket(socket) {
+        timer.callback = [this]() {
+            expired = true;
+            CancelIoEx(reinterpret_cast<HANDLE>(this->socket), nullptr);
+        };
+    }
+
+    Deadline(const Deadline&) = delete;
+    Deadline& operator=(const Deadline&) = delete;
+
+    void arm(std::chrono::milliseconds timeout) {
+        expired = false;
+        loop.schedule(timer, timeout);
+    }
+
+    void disarm() {
+        loop.cancel(timer);
+    }
+
+    bool hasExpired() const {
+        return expired;
+    }
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Coroutine frame storage owned by one event loop. A connection's state lives
+// in its handler's frame, so with the loop pinned this keeps connections and
+// the tasks they await on the loop's NUMA node. Frames are rounded up to a
+// power of two and recycled per size; slabs go back to the system with the
+// pool. Frames above the largest class, and frames allocated off a loop
+// thread, come from the global heap.
+//
+// Allocation is loop-thread only. A frame freed on another thread is handed
+// back under a lock and reused on the loop's next allocation of that size.
+class FramePool {
+public:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t MIN_FRAME = 64;
+    static constexpr size_t MAX_FRAME = 16 * 1024;
+
+    // Operator new/delete for coroutine promises (see Task.hpp).
+    static void* allocate(size_t size) {
+        FramePool* pool = current;
+        size_t total = size + HEADER;
+
+        void* block = pool != nullptr && total <= MAX_FRAME ? pool->take(classOf(total)) : nullptr;
+        if (block == nullptr) {
+            block = ::operator new(total);
+            pool = nullptr;
+        }
+
+        static_cast<Header*>(block)->owner = pool;
+        return static_cast<char*>(block) + HEADER;
+    }
+
+    static void deallocate(void* frame, size_t size) {
+        if (frame == nullptr) return;
+
+        void* block = static_cast<char*>(frame) - HEADER;
+        FramePool* owner = static_cast<Header*>(block)->owner;
+        if (owner == nullptr) {
+            ::operator delete(block);
+        } else if (owner == current) {
+            owner->give(classOf(size + HEADER), block);
+        } else {
+            owner->giveRemote(classOf(size + HEADER), block);
+        }
+    }
+
+    FramePool() = default;
+
+    ~FramePool() {
+        // A frame still out (a coroutine never resumed at shutdown) would be
+        // freed into released memory; leave the slabs to the process then.
+        reclaim();
+        if (outstanding != 0) return;
+        for (void* slab : slabs) {
+            VirtualFree(slab, 0, MEM_RELEASE);
+        }
+    }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // NUMA node for slabs allocated from now on.
+    void setNode(DWORD preferred) {
+        node = preferred;
+    }
+
+    // Loop thread: frames allocated on this thread come from pool from now on.
+    static void bind(FramePool* pool) {
+        current = pool;
+    }
+
+private:
+    // Keeps frames at the default new alignment.
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header {
+        FramePool* owner;
+    };
+    static constexpr size_t HEADER = sizeof(Header);
+    static constexpr size_t CLASSES = 9;    // 64 B .. 16 KB
+
+    inline static thread_local FramePool* current = nullptr;
+
+    std::array<std::vector<void*>, CLASSES> freeLists;
+    std::vector<void*> slabs;
+    DWORD node = NUMA_NO_PREFERRED_NODE;
+    size_t outstanding = 0;
+
+    std::mutex remoteMtx;
+    std::array<std::vector<void*>, CLASSES> remoteFrees;
+    std::atomic<size_t> remoteCount{ 0 };
+
+    static size_t classOf(size_t total) {
+        size_t index = 0;
+        for (size_t frame = MIN_FRAME; frame < total; frame <<= 1) ++index;
+        return index;
+    }
+
+    void* take(size_t index) {
+        std::vector<void*>& freeList = freeLists[index];
+        if (freeList.empty() && remoteCount.load(std::memory_order_relaxed) > 0) reclaim();
+        if (freeList.empty() && !grow(index)) return nullptr;
+
+        void* block = freeList.back();
+        freeList.pop_back();
+        ++outstanding;
+        return block;
+    }
+
+    void give(size_t index, void* block) {
+        freeLists[index].push_back(block);
+        --outstanding;
+    }
+
+    void giveRemote(size_t index, void* block) {
+        std::lock_guard<std::mutex> lock(remoteMtx);
+        remoteFrees[index].push_back(block);
+        remoteCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void reclaim() {
+        std::lock_guard<std::mutex> lock(remoteMtx);
+        for (size_t i = 0; i < CLASSES; ++i) {
+            outstanding -= remoteFrees[i].size();
+            freeLists[i].insert(freeLists[i].end(), remoteFrees[i].begin(), remoteFrees[i].end());
+            remoteFrees[i].clear();
+        }
+        remoteCount.store(0, std::memory_order_relaxed);
+    }
+
+    bool grow(size_t index) {
+        void* slab = node == NUMA_NO_PREFERRED_NODE
+            ? VirtualAlloc(nullptr, SLAB_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE)
+            : VirtualAllocExNuma(GetCurrentProcess(), nullptr, SLAB_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+        if (slab == nullptr) return false;
+
+        slabs.push_back(slab);
+        const size_t frame = MIN_FRAME << index;
+        for (size_t offset = SLAB_SIZE; offset >= frame; offset -= frame) {
+            freeLists[index].push_back(static_cast<char*>(slab) + offset - frame);
+        }
+        return true;
+    }
+};
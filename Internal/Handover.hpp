@@ -0,0 +1,227 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hands the listening socket to a replacement process so a restart never
+// refuses a connection. The running server serves a local named pipe; a new
+// process started with --takeover connects, receives a duplicate of the
+// listener (WSADuplicateSocket) and acknowledges once it holds it. The old
+// process then stops accepting and drains. Connections arriving in between
+// wait in the backlog both processes share. Only processes running as the
+// same user can open the pipe or be handed the socket.
+class SocketHandover {
+private:
+    static constexpr DWORD IO_TIMEOUT = 5000;
+
+    SOCKET listener;
+    WSAEVENT handedOver;
+    std::wstring name;
+    HANDLE stopEvent = nullptr;
+    std::thread worker;
+
+    std::vector<BYTE> owner;    // TOKEN_USER of this process
+    std::vector<BYTE> acl;
+    SECURITY_DESCRIPTOR descriptor{};
+
+    static std::wstring pipeName(int port) {
+        return L"\\\\.\\pipe\\winminiframework-" + std::to_wstring(port);
+    }
+
+    // The user a process runs as, as a TOKEN_USER; empty when it cannot be read.
+    static std::vector<BYTE> tokenUser(HANDLE process) {
+        std::vector<BYTE> user;
+        HANDLE token = nullptr;
+        if (!OpenProcessToken(process, TOKEN_QUERY, &token)) return user;
+
+        DWORD length = 0;
+        GetTokenInformation(token, TokenUser, nullptr, 0, &length);
+        user.resize(length);
+        if (length == 0 || !GetTokenInformation(token, TokenUser, user.data(), length, &length)) user.clear();
+        CloseHandle(token);
+        return user;
+    }
+
+    static PSID sidOf(std::vector<BYTE>& user) {
+        return reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid;
+    }
+
+    // A DACL granting this process's user, and nobody else, access to the pipe.
+    bool restrictToOwner() {
+        owner = tokenUser(GetCurrentProcess());
+        if (owner.empty()) return false;
+
+        PSID sid = sidOf(owner);
+        acl.resize(sizeof(ACL) + sizeof(ACCESS_ALLOWED_ACE) - sizeof(DWORD) + GetLengthSid(sid));
+        PACL dacl = reinterpret_cast<PACL>(acl.data());
+        return InitializeAcl(dacl, static_cast<DWORD>(acl.size()), ACL_REVISION) &&
+            AddAccessAllowedAce(dacl, ACL_REVISION, GENERIC_ALL, sid) &&
+            InitializeSecurityDescriptor(&descriptor, SECURITY_DESCRIPTOR_REVISION) &&
+            SetSecurityDescriptorDacl(&descriptor, TRUE, dacl, FALSE);
+    }
+
+    // Waits for overlapped pipe I/O, bounded so a stuck client cannot hold on
+    // to the listener.
+    static bool complete(HANDLE pipe, OVERLAPPED& overlapped, BOOL started, DWORD expected) {
+        DWORD bytes = 0;
+        if (!started) {
+            if (GetLastError() != ERROR_IO_PENDING) return false;
+            if (WaitForSingleObject(overlapped.hEvent, IO_TIMEOUT) != WAIT_OBJECT_0) {
+                CancelIoEx(pipe, &overlapped);
+                GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+                return false;
+            }
+        }
+        return GetOverlappedResult(pipe, &overlapped, &bytes, FALSE) && bytes == expected;
+    }
+
+    bool handOver(HANDLE pipe, OVERLAPPED& overlapped) {
+        // Trust the kernel for the client's identity, not the client.
+        ULONG clientPid = 0;
+        if (!GetNamedPipeClientProcessId(pipe, &clientPid)) return false;
+
+        // The DACL keeps other users from opening the pipe; check the client
+        // itself before giving it the socket all the same.
+        std::vector<BYTE> clientUser;
+        if (HANDLE client = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, clientPid)) {
+            clientUser = tokenUser(client);
+            CloseHandle(client);
+        }
+        if (clientUser.empty() || !EqualSid(sidOf(clientUser), sidOf(owner))) {
+            std::cout << "[!] [Handover] Process " << clientPid << " does not run as this server's user, refused." << std::endl;
+            return false;
+        }
+
+        WSAPROTOCOL_INFOW info;
+        if (WSADuplicateSocketW(listener, clientPid, &info) != 0) {
+            std::cout << "[!] [Handover] WSADuplicateSocket() failed: " << WSAGetLastError() << std::endl;
+            return false;
+        }
+
+        if (!complete(pipe, overlapped, WriteFile(pipe, &info, sizeof(info), nullptr, &overlapped), sizeof(info))) return false;
+
+        char ack = 0;
+        if (!complete(pipe, overlapped, ReadFile(pipe, &ack, 1, nullptr, &overlapped), 1) || ack != 1) {
+            std::cout << "[!] [Handover] Process " << clientPid << " did not take the listening socket." << std::endl;
+            return false;
+        }
+
+        std::cout << "[*] [Handover] Listening socket handed to process " << clientPid << "." << std::endl;
+        return true;
+    }
+
+    void serve() {
+        OVERLAPPED overlapped{};
+        overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        SECURITY_ATTRIBUTES security{ sizeof(security), &descriptor, FALSE };
+        bool reported = false;
+
+        while (true) {
+            HANDLE pipe = CreateNamedPipeW(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 4096, 4096, 0, &security);
+
+            if (pipe == INVALID_HANDLE_VALUE) {
+                // The process we took over from may still be closing its end.
+                if (!reported) {
+                    std::cout << "[!] [Handover] Unable to create pipe: " << GetLastError() << ", retrying." << std::endl;
+                    reported = true;
+                }
+                if (WaitForSingleObject(stopEvent, 1000) == WAIT_OBJECT_0) break;
+                continue;
+            }
+
+            BOOL connected = ConnectNamedPipe(pipe, &overlapped);
+            DWORD error = connected ? 0 : GetLastError();
+            if (!connected && error == ERROR_PIPE_CONNECTED) connected = TRUE;
+
+            if (!connected && error == ERROR_IO_PENDING) {
+                HANDLE handles[2] = { overlapped.hEvent, stopEvent };
+                DWORD bytes = 0;
+                if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0) {
+                    CancelIoEx(pipe, &overlapped);
+                    GetOverlappedResult(pipe, &overlapped, &bytes, TRUE);
+                    CloseHandle(pipe);
+                    break;
+                }
+                connected = GetOverlappedResult(pipe, &overlapped, &bytes, FALSE);
+            }
+
+            bool done = connected && handOver(pipe, overlapped);
+            DisconnectNamedPipe(pipe);
+            CloseHandle(pipe);
+
+            if (done) {
+                WSASetEvent(handedOver);
+                break;
+            }
+        }
+
+        CloseHandle(overlapped.hEvent);
+    }
+
+public:
+    // Offers listener to replacement processes until one takes it, then sets
+    // handedOver.
+    SocketHandover(int port, SOCKET listener, WSAEVENT handedOver)
+        : listener(listener), handedOver(handedOver), name(pipeName(port)) {
+        stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (!restrictToOwner()) {
+            std::cout << "[!] [Handover] Unable to secure the pipe: " << GetLastError() << ", takeover is disabled." << std::endl;
+            return;
+        }
+        worker = std::thread(&SocketHandover::serve, this);
+    }
+
+    ~SocketHandover() {
+        SetEvent(stopEvent);
+        if (worker.joinable()) worker.join();
+        CloseHandle(stopEvent);
+    }
+
+    SocketHandover(const SocketHandover&) = delete;
+    SocketHandover& operator=(const SocketHandover&) = delete;
+
+    // Asks the server running on port for its listening socket. Returns
+    // INVALID_SOCKET when there is none, and the caller binds as usual.
+    static SOCKET acquire(int port) {
+        std::wstring name = pipeName(port);
+        if (!WaitNamedPipeW(name.c_str(), IO_TIMEOUT)) {
+            std::cout << "[!] [Handover] No running server on port " << port << " to take over from." << std::endl;
+            return INVALID_SOCKET;
+        }
+
+        HANDLE pipe = CreateFileW(name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            std::cout << "[!] [Handover] Unable to open pipe: " << GetLastError() << std::endl;
+            return INVALID_SOCKET;
+        }
+
+        DWORD mode = PIPE_READMODE_MESSAGE;
+        SetNamedPipeHandleState(pipe, &mode, nullptr, nullptr);
+
+        WSAPROTOCOL_INFOW info;
+        DWORD bytes = 0;
+        SOCKET socket = INVALID_SOCKET;
+        if (ReadFile(pipe, &info, sizeof(info), &bytes, nullptr) && bytes == sizeof(info)) {
+            socket = WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, WSA_FLAG_OVERLAPPED);
+
+            char ack = 1;
+            if (socket != INVALID_SOCKET && !WriteFile(pipe, &ack, 1, &bytes, nullptr)) {
+                closesocket(socket);
+                socket = INVALID_SOCKET;
+            }
+        }
+        CloseHandle(pipe);
+
+        if (socket == INVALID_SOCKET) {
+            std::cout << "[!] [Handover] Takeover failed." << std::endl;
+        } else {
+            std::cout << "[*] [Handover] Took over the listening socket on port " << port << "." << std::endl;
+        }
+        return socket;
+    }
+};
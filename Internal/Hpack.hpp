@@ -0,0 +1,452 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HPACK (RFC 7541) header compression for HTTP/2: static and dynamic tables,
+// prefix integers and Huffman-coded string literals.
+namespace HPACK {
+    using HeaderList = std::vector<std::pair<std::string, std::string>>;
+
+    constexpr size_t DEFAULT_TABLE_SIZE = 4096;
+
+    namespace Detail {
+        struct StaticEntry {
+            std::string_view name;
+            std::string_view value;
+        };
+
+        inline constexpr StaticEntry STATIC_TABLE[] = {
+            { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" }, { ":path", "/" },
+            { ":path", "/index.html" }, { ":scheme", "http" }, { ":scheme", "https" }, { ":status", "200" },
+            { ":status", "204" }, { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+            { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" }, { "accept-encoding", "gzip, deflate" },
+            { "accept-language", "" }, { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+            { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+            { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" }, { "content-length", "" },
+            { "content-location", "" }, { "content-range", "" }, { "content-type", "" }, { "cookie", "" },
+            { "date", "" }, { "etag", "" }, { "expect", "" }, { "expires", "" },
+            { "from", "" }, { "host", "" }, { "if-match", "" }, { "if-modified-since", "" },
+            { "if-none-match", "" }, { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+            { "link", "" }, { "location", "" }, { "max-forwards", "" }, { "proxy-authenticate", "" },
+            { "proxy-authorization", "" }, { "range", "" }, { "referer", "" }, { "refresh", "" },
+            { "retry-after", "" }, { "server", "" }, { "set-cookie", "" }, { "strict-transport-security", "" },
+            { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+            { "www-authenticate", "" },
+        };
+
+        constexpr size_t STATIC_COUNT = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+        struct HuffmanCode {
+            uint32_t code;
+            uint8_t bits;
+        };
+
+        // Index 256 is EOS.
+        inline constexpr HuffmanCode HUFFMAN_CODES[257] = {
+        { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 }, { 0xfffffe4, 28 }, { 0xfffffe5, 28 },
+        { 0xfffffe6, 28 }, { 0xfffffe7, 28 }, { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+        { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 }, { 0xfffffed, 28 }, { 0xfffffee, 28 },
+        { 0xfffffef, 28 }, { 0xffffff0, 28 }, { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+        { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 }, { 0xffffff8, 28 }, { 0xffffff9, 28 },
+        { 0xffffffa, 28 }, { 0xffffffb, 28 }, { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+        { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+        { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+        { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 }, { 0x1b, 6 },
+        { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+        { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 },
+        { 0x5d, 7 }, { 0x5e, 7 }, { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+        { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+        { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+        { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 }, { 0xfc, 8 }, { 0x73, 7 },
+        { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+        { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 },
+        { 0x25, 6 }, { 0x26, 6 }, { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+        { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 },
+        { 0x2c, 6 }, { 0x8, 5 }, { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+        { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 },
+        { 0x1ffd, 13 }, { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+        { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 },
+        { 0x7fffdb, 23 }, { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+        { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 },
+        { 0x7fffe2, 23 }, { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+        { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 },
+        { 0xfffe9, 20 }, { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+        { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 },
+        { 0x7fffeb, 23 }, { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+        { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 },
+        { 0x3fffe3, 22 }, { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+        { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 },
+        { 0x3fffe8, 22 }, { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+        { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 },
+        { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+        { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 },
+        { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+        { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 },
+        { 0x1ffffee, 25 }, { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+        { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 },
+        { 0x7ffffe9, 27 }, { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+        { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 }, { 0x3fffffff, 30 },
+        };
+
+        // Binary decoding tree built once from HUFFMAN_CODES.
+        struct HuffmanTree {
+            struct Node {
+                int child[2] = { -1, -1 };
+                int symbol = -1;
+            };
+
+            std::vector<Node> nodes;
+
+            HuffmanTree() {
+                nodes.emplace_back();
+                for (int symbol = 0; symbol < 257; ++symbol) {
+                    const HuffmanCode& code = HUFFMAN_CODES[symbol];
+                    int current = 0;
+                    for (int bit = code.bits - 1; bit >= 0; --bit) {
+                        int branch = (code.code >> bit) & 1;
+                        if (nodes[current].child[branch] < 0) {
+                            nodes[current].child[branch] = static_cast<int>(nodes.size());
+                            nodes.emplace_back();
+                        }
+                        current = nodes[current].child[branch];
+                    }
+                    nodes[current].symbol = symbol;
+                }
+            }
+
+            static const HuffmanTree& instance() {
+                static const HuffmanTree tree;
+                return tree;
+            }
+        };
+
+        inline size_t huffmanLength(std::string_view s) {
+            size_t bits = 0;
+            for (unsigned char c : s) bits += HUFFMAN_CODES[c].bits;
+            return (bits + 7) / 8;
+        }
+
+        inline void huffmanEncode(std::string_view s, std::string& out) {
+            uint64_t buffer = 0;
+            int pending = 0;
+            for (unsigned char c : s) {
+                const HuffmanCode& code = HUFFMAN_CODES[c];
+                buffer = (buffer << code.bits) | code.code;
+                pending += code.bits;
+                while (pending >= 8) {
+                    pending -= 8;
+                    out.push_back(static_cast<char>(buffer >> pending));
+                }
+            }
+            // Pad with the most significant bits of EOS (all ones).
+            if (pending > 0) {
+                out.push_back(static_cast<char>((buffer << (8 - pending)) | (0xFF >> pending)));
+            }
+        }
+
+        inline bool huffmanDecode(const uint8_t* data, size_t size, std::string& out) {
+            const HuffmanTree& tree = HuffmanTree::instance();
+            int current = 0;
+            int depth = 0;
+            bool allOnes = true;
+
+            for (size_t i = 0; i < size; ++i) {
+                for (int bit = 7; bit >= 0; --bit) {
+                    int branch = (data[i] >> bit) & 1;
+                    current = tree.nodes[current].child[branch];
+                    if (current < 0) return false;
+
+                    ++depth;
+                    allOnes = allOnes && branch == 1;
+
+                    int symbol = tree.nodes[current].symbol;
+                    if (symbol >= 0) {
+                        if (symbol == 256) return false;
+                        out.push_back(static_cast<char>(symbol));
+                        current = 0;
+                        depth = 0;
+                        allOnes = true;
+                    }
+                }
+            }
+
+            // Padding must be a strict prefix of EOS shorter than one octet.
+            return depth < 8 && allOnes;
+        }
+
+        inline void encodeInteger(uint64_t value, int prefixBits, uint8_t firstByte, std::string& out) {
+            const uint64_t limit = (1u << prefixBits) - 1;
+            if (value < limit) {
+                out.push_back(static_cast<char>(firstByte | value));
+                return;
+            }
+            out.push_back(static_cast<char>(firstByte | limit));
+            value -= limit;
+            while (value >= 128) {
+                out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        inline bool decodeInteger(const uint8_t*& p, const uint8_t* end, int prefixBits, uint64_t& value) {
+            if (p >= end) return false;
+            const uint64_t limit = (1u << prefixBits) - 1;
+            value = *p++ & limit;
+            if (value < limit) return true;
+
+            int shift = 0;
+            while (p < end) {
+                uint8_t byte = *p++;
+                value += static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) return true;
+                shift += 7;
+                if (shift > 28) return false;
+            }
+            return false;
+        }
+
+        inline void encodeString(std::string_view s, std::string& out) {
+            size_t huffman = huffmanLength(s);
+            if (huffman < s.size()) {
+                encodeInteger(huffman, 7, 0x80, out);
+                huffmanEncode(s, out);
+            } else {
+                encodeInteger(s.size(), 7, 0x00, out);
+                out.append(s);
+            }
+        }
+
+        inline bool decodeString(const uint8_t*& p, const uint8_t* end, std::string& out) {
+            if (p >= end) return false;
+            bool huffman = (*p & 0x80) != 0;
+            uint64_t length = 0;
+            if (!decodeInteger(p, end, 7, length)) return false;
+            if (length > static_cast<uint64_t>(end - p)) return false;
+
+            if (huffman) {
+                if (!huffmanDecode(p, static_cast<size_t>(length), out)) return false;
+            } else {
+                out.assign(reinterpret_cast<const char*>(p), static_cast<size_t>(length));
+            }
+            p += length;
+            return true;
+        }
+    }
+
+    // FIFO of recently used fields; index 0 is the newest entry.
+    class DynamicTable {
+    private:
+        std::deque<std::pair<std::string, std::string>> entries;
+        size_t size = 0;
+        size_t maxSize = DEFAULT_TABLE_SIZE;
+
+        static size_t entrySize(const std::string& name, const std::string& value) {
+            return name.size() + value.size() + 32;
+        }
+
+        void evict(size_t limit) {
+            while (size > limit && !entries.empty()) {
+                size -= entrySize(entries.back().first, entries.back().second);
+                entries.pop_back();
+            }
+        }
+
+    public:
+        void add(const std::string& name, const std::string& value) {
+            size_t needed = entrySize(name, value);
+            if (needed > maxSize) {
+                entries.clear();
+                size = 0;
+                return;
+            }
+            evict(maxSize - needed);
+            entries.emplace_front(name, value);
+            size += needed;
+        }
+
+        void resize(size_t limit) {
+            maxSize = limit;
+            evict(maxSize);
+        }
+
+        size_t count() const {
+            return entries.size();
+        }
+
+        const std::pair<std::string, std::string>& at(size_t index) const {
+            return entries[index];
+        }
+    };
+
+    class Decoder {
+    private:
+        DynamicTable table;
+        size_t maxTableSize = DEFAULT_TABLE_SIZE;
+
+        bool lookup(uint64_t index, std::string& name, std::string& value) const {
+            if (index == 0) return false;
+            if (index <= Detail::STATIC_COUNT) {
+                name = Detail::STATIC_TABLE[index - 1].name;
+                value = Detail::STATIC_TABLE[index - 1].value;
+                return true;
+            }
+            index -= Detail::STATIC_COUNT + 1;
+            if (index >= table.count()) return false;
+            name = table.at(static_cast<size_t>(index)).first;
+            value = table.at(static_cast<size_t>(index)).second;
+            return true;
+        }
+
+    public:
+        enum class Result {
+            Ok,
+            TooLarge,   // the header list exceeds maxListSize; headers is incomplete
+            Error       // connection error (COMPRESSION_ERROR); the decoder is unusable
+        };
+
+        // Decodes one complete header block. Each field counts its name and
+        // value plus 32 bytes toward maxListSize (RFC 7541 4.1), as
+        // SETTINGS_MAX_HEADER_LIST_SIZE does. Past the limit the block is still
+        // decoded, since the dynamic table must stay in step with the peer's,
+        // but no more fields are kept.
+        Result decode(const uint8_t* data, size_t size, HeaderList& headers, size_t maxListSize = SIZE_MAX) {
+            const uint8_t* p = data;
+            const uint8_t* end = data + size;
+            size_t listSize = 0;
+            bool tooLarge = false;
+            bool fieldSeen = false;
+
+            auto keep = [&](std::string& name, std::string& value) {
+                listSize += name.size() + value.size() + 32;
+                if (listSize > maxListSize) tooLarge = true;
+                if (!tooLarge) headers.emplace_back(std::move(name), std::move(value));
+            };
+
+            while (p < end) {
+                uint8_t first = *p;
+                std::string name;
+                std::string value;
+
+                if (first & 0x80) {
+                    uint64_t index = 0;
+                    if (!Detail::decodeInteger(p, end, 7, index)) return Result::Error;
+                    fieldSeen = true;
+                    if (tooLarge) {
+                        // Only check the reference; copying it is what a bomb relies on.
+                        if (index == 0 || index > Detail::STATIC_COUNT + table.count()) return Result::Error;
+                        continue;
+                    }
+                    if (!lookup(index, name, value)) return Result::Error;
+                    keep(name, value);
+                    continue;
+                }
+
+                // Table size updates may only open a header block (RFC 7541 4.2).
+                if ((first & 0xE0) == 0x20) {
+                    uint64_t limit = 0;
+                    if (fieldSeen || !Detail::decodeInteger(p, end, 5, limit) || limit > maxTableSize) return Result::Error;
+                    table.resize(static_cast<size_t>(limit));
+                    continue;
+                }
+                fieldSeen = true;
+
+                bool indexing = (first & 0xC0) == 0x40;
+                uint64_t nameIndex = 0;
+                if (!Detail::decodeInteger(p, end, indexing ? 6 : 4, nameIndex)) return Result::Error;
+
+                if (nameIndex > 0) {
+                    std::string unused;
+                    if (!lookup(nameIndex, name, unused)) return Result::Error;
+                } else if (!Detail::decodeString(p, end, name)) {
+                    return Result::Error;
+                }
+                if (!Detail::decodeString(p, end, value)) return Result::Error;
+
+                if (indexing) table.add(name, value);
+                keep(name, value);
+            }
+            return tooLarge ? Result::TooLarge : Result::Ok;
+        }
+    };
+
+    class Encoder {
+    private:
+        DynamicTable table;
+        size_t maxTableSize = DEFAULT_TABLE_SIZE;
+        bool sizeChanged = false;
+
+        // Returns the best index for the field: exact match, or name-only match
+        // (exact == false), or 0 when the name is unknown.
+        uint64_t find(const std::string& name, const std::string& value, bool& exact) const {
+            uint64_t nameIndex = 0;
+            exact = false;
+
+            for (size_t i = 0; i < Detail::STATIC_COUNT; ++i) {
+                if (Detail::STATIC_TABLE[i].name != name) continue;
+                if (Detail::STATIC_TABLE[i].value == value) {
+                    exact = true;
+                    return i + 1;
+                }
+                if (nameIndex == 0) nameIndex = i + 1;
+            }
+            for (size_t i = 0; i < table.count(); ++i) {
+                const auto& entry = table.at(i);
+                if (entry.first != name) continue;
+                if (entry.second == value) {
+                    exact = true;
+                    return Detail::STATIC_COUNT + 1 + i;
+                }
+                if (nameIndex == 0) nameIndex = Detail::STATIC_COUNT + 1 + i;
+            }
+            return nameIndex;
+        }
+
+    public:
+        // Applies the peer's SETTINGS_HEADER_TABLE_SIZE (capped at our default).
+        void setMaxTableSize(size_t size) {
+            size_t limit = size < DEFAULT_TABLE_SIZE ? size : DEFAULT_TABLE_SIZE;
+            if (limit != maxTableSize) {
+                maxTableSize = limit;
+                sizeChanged = true;
+            }
+        }
+
+        // Header names must already be lowercase.
+        void encode(const HeaderList& headers, std::string& out) {
+            if (sizeChanged) {
+                table.resize(maxTableSize);
+                Detail::encodeInteger(maxTableSize, 5, 0x20, out);
+                sizeChanged = false;
+            }
+
+            for (const auto& [name, value] : headers) {
+                bool exact = false;
+                uint64_t index = find(name, value, exact);
+
+                if (exact) {
+                    Detail::encodeInteger(index, 7, 0x80, out);
+                    continue;
+                }
+
+                // Cookies and credentials are never indexed so they cannot be
+                // probed through the compression context.
+                bool sensitive = name == "set-cookie" || name == "authorization";
+                if (sensitive) {
+                    Detail::encodeInteger(index, 4, 0x10, out);
+                } else {
+                    Detail::encodeInteger(index, 6, 0x40, out);
+                }
+                if (index == 0) Detail::encodeString(name, out);
+                Detail::encodeString(value, out);
+
+                if (!sensitive) table.add(name, value);
+            }
+        }
+    };
+}
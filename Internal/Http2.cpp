@@ -0,0 +1,723 @@
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+
+#include "Http2.hpp"
+#include "RequestParser.hpp"
+
+namespace {
+    uint32_t read32(const char* p) {
+        auto* u = reinterpret_cast<const uint8_t*>(p);
+        return (static_cast<uint32_t>(u[0]) << 24) | (static_cast<uint32_t>(u[1]) << 16) | (static_cast<uint32_t>(u[2]) << 8) | u[3];
+    }
+
+    uint16_t read16(const char* p) {
+        auto* u = reinterpret_cast<const uint8_t*>(p);
+        return static_cast<uint16_t>((u[0] << 8) | u[1]);
+    }
+
+    void write32(std::string& out, uint32_t value) {
+        out.push_back(static_cast<char>(value >> 24));
+        out.push_back(static_cast<char>(value >> 16));
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value));
+    }
+
+    void writeSetting(std::string& out, uint16_t id, uint32_t value) {
+        out.push_back(static_cast<char>(id >> 8));
+        out.push_back(static_cast<char>(id));
+        write32(out, value);
+    }
+
+    // HTTP2-Settings carries a SETTINGS payload in unpadded base64url.
+    bool decodeBase64Url(const std::string& in, std::string& out) {
+        uint32_t buffer = 0;
+        int bits = 0;
+        for (char c : in) {
+            int value;
+            if (c >= 'A' && c <= 'Z') value = c - 'A';
+            else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') value = c - '0' + 52;
+            else if (c == '-') value = 62;
+            else if (c == '_') value = 63;
+            else if (c == '=') break;
+            else return false;
+
+            buffer = (buffer << 6) | static_cast<uint32_t>(value);
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out.push_back(static_cast<char>(buffer >> bits));
+            }
+        }
+        return true;
+    }
+
+    // Request handlers look headers up in their HTTP/1.1 spelling.
+    std::string canonicalName(const std::string& name) {
+        std::string result = name;
+        bool upper = true;
+        for (char& c : result) {
+            if (upper) c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+            upper = c == '-';
+        }
+        return result;
+    }
+
+    std::string lowercase(const std::string& s) {
+        std::string result = s;
+        std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) {
+            return static_cast<char>(std::tolower(c));
+        });
+        return result;
+    }
+}
+
+Task<void> Http2Connection::run(std::string input, std::unique_ptr<Request> upgraded, const std::string& settings, std::unique_ptr<Response> answer) {
+    std::string serverSettings;
+    writeSetting(serverSettings, 0x3, options.maxConcurrentStreams);
+    writeSetting(serverSettings, 0x4, options.initialWindowSize);
+    writeSetting(serverSettings, 0x6, static_cast<uint32_t>(options.maxRequestSize));
+    queueFrame(Settings, 0, 0, serverSettings.data(), serverSettings.size());
+
+    // SETTINGS only sizes stream windows; the connection window grows explicitly.
+    if (options.initialWindowSize > DEFAULT_WINDOW) {
+        receiveWindow = options.initialWindowSize;
+        queueWindowUpdate(0, options.initialWindowSize - DEFAULT_WINDOW);
+    }
+
+    if (upgraded) {
+        // The 101 response acknowledges HTTP2-Settings implicitly.
+        std::string payload;
+        if (!decodeBase64Url(settings, payload) || payload.size() % 6 != 0 || !applySettings(payload.data(), payload.size())) {
+            co_return;
+        }
+
+        auto stream = std::make_shared<Stream>();
+        stream->id = 1;
+        stream->request = std::move(*upgraded);
+        stream->answer = std::move(answer);
+        stream->remoteClosed = true;
+        stream->sendWindow = peerInitialWindow;
+        lastStreamId = 1;
+        streams[1] = stream;
+        startStream(stream);
+    }
+
+    started = true;
+    if (goingAway) sendGoAway();
+
+    bool prefaceSeen = false;
+    bool settingsSeen = false;
+    size_t offset = 0;
+
+    while (!broken) {
+        if (!prefaceSeen) {
+            if (input.size() >= PREFACE.size()) {
+                if (input.compare(0, PREFACE.size(), PREFACE) != 0) {
+                    fail(ProtocolError);
+                    break;
+                }
+                offset = PREFACE.size();
+                prefaceSeen = true;
+                continue;
+            }
+        } else if (input.size() - offset >= 9) {
+            const char* header = input.data() + offset;
+            uint32_t length = read32(header) >> 8;
+            uint8_t type = static_cast<uint8_t>(header[3]);
+            uint8_t flags = static_cast<uint8_t>(header[4]);
+            uint32_t streamId = read32(header + 5) & 0x7FFFFFFF;
+
+            if (length > MAX_FRAME_SIZE) {
+                fail(FrameSizeError);
+                break;
+            }
+
+            if (input.size() - offset >= 9 + length) {
+                // The client preface must be followed by its SETTINGS.
+                if (!settingsSeen && type != Settings) {
+                    fail(ProtocolError);
+                    break;
+                }
+                settingsSeen = true;
+
+                if (!processFrame(type, flags, streamId, header + 9, length)) break;
+
+                offset += 9 + length;
+                if (peerGoingAway) break;
+                continue;
+            }
+        }
+
+        if (offset > 0) {
+            input.erase(0, offset);
+            offset = 0;
+        }
+
+        flush();
+        updateDeadline();
+
+        int bytesRead = co_await connection.receive(input);
+        if (bytesRead <= 0) break;
+    }
+
+    if (error != NoError) {
+        std::string payload;
+        write32(payload, lastStreamId);
+        write32(payload, error);
+        queueFrame(GoAway, 0, 0, payload.data(), payload.size());
+    }
+    flush();
+
+    // Handlers reference this object; let them (and the writer) finish first.
+    if (tasks > 0) co_await DrainAwaiter{ *this };
+    connection.deadline.disarm();
+}
+
+void Http2Connection::queueFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t size) {
+    char header[9] = {
+        static_cast<char>(size >> 16), static_cast<char>(size >> 8), static_cast<char>(size),
+        static_cast<char>(type), static_cast<char>(flags),
+        static_cast<char>((streamId >> 24) & 0x7F), static_cast<char>(streamId >> 16), static_cast<char>(streamId >> 8), static_cast<char>(streamId)
+    };
+    outbox.append(header, sizeof(header));
+    if (size > 0) outbox.append(payload, size);
+}
+
+void Http2Connection::queueWindowUpdate(uint32_t streamId, uint32_t increment) {
+    std::string payload;
+    write32(payload, increment & MAX_WINDOW);
+    queueFrame(WindowUpdate, 0, streamId, payload.data(), payload.size());
+}
+
+void Http2Connection::resetStream(uint32_t streamId, ErrorCode code) {
+    std::string payload;
+    write32(payload, code);
+    queueFrame(RstStream, 0, streamId, payload.data(), payload.size());
+
+    auto it = streams.find(streamId);
+    if (it != streams.end()) {
+        it->second->reset = true;
+        streams.erase(it);
+    }
+}
+
+void Http2Connection::goAway() {
+    if (goingAway) return;
+    goingAway = true;
+    if (started) sendGoAway();
+}
+
+void Http2Connection::sendGoAway() {
+    std::string payload;
+    write32(payload, lastStreamId);
+    write32(payload, NoError);
+    queueFrame(GoAway, 0, 0, payload.data(), payload.size());
+    flush();
+    updateDeadline();
+}
+
+void Http2Connection::closeStream(uint32_t streamId) {
+    streams.erase(streamId);
+    updateDeadline();
+}
+
+void Http2Connection::flush() {
+    if (writing || broken || outbox.empty()) return;
+
+    writing = true;
+    ++tasks;
+    spawn(writer());
+}
+
+Task<void> Http2Connection::writer() {
+    while (!outbox.empty() && !broken) {
+        std::string chunk;
+        chunk.swap(outbox);
+
+        connection.deadline.arm(options.writeTimeout);
+        if (!co_await connection.send(chunk, std::string())) broken = true;
+    }
+
+    writing = false;
+    updateDeadline();
+    taskDone();
+}
+
+void Http2Connection::taskDone() {
+    if (--tasks > 0 || !drained) return;
+
+    // Resume run() from the loop rather than from inside this coroutine's frame.
+    std::coroutine_handle<> handle = drained;
+    drained = nullptr;
+    connection.loop.post([handle]() {
+        handle.resume();
+    });
+}
+
+void Http2Connection::updateDeadline() {
+    // While writing the write deadline stands. A stream whose request is still
+    // arriving, or whose response is held back by the client's flow-control
+    // window, waits on the client; only when every open stream is waiting on
+    // its handler is there nothing to time out.
+    if (writing) return;
+
+    if (streams.empty()) {
+        connection.deadline.arm(options.idleTimeout ? options.idleTimeout() : std::chrono::milliseconds(5000));
+        return;
+    }
+
+    bool waitingOnClient = false;
+    for (const auto& [id, stream] : streams) {
+        if (!stream->remoteClosed) waitingOnClient = true;
+    }
+    for (const auto& stream : sending) {
+        if (!stream->reset) waitingOnClient = true;
+    }
+
+    if (waitingOnClient) {
+        connection.deadline.arm(options.bodyTimeout);
+    } else {
+        connection.deadline.disarm();
+    }
+}
+
+bool Http2Connection::processFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t size) {
+    // A header block must be finished before anything else is interleaved.
+    if (headerStreamId != 0 && (type != Continuation || streamId != headerStreamId)) {
+        return fail(ProtocolError);
+    }
+
+    switch (type) {
+    case Data:
+        return onData(flags, streamId, payload, size);
+
+    case Headers:
+        return onHeaders(flags, streamId, payload, size);
+
+    case Priority:
+        if (streamId == 0) return fail(ProtocolError);
+        if (size != 5) resetStream(streamId, FrameSizeError);
+        return true;
+
+    case RstStream:
+        if (streamId == 0 || streamId > lastStreamId) return fail(ProtocolError);
+        if (size != 4) return fail(FrameSizeError);
+        if (auto it = streams.find(streamId); it != streams.end()) {
+            it->second->reset = true;
+            closeStream(streamId);
+        }
+        return true;
+
+    case Settings:
+        return onSettings(flags, streamId, payload, size);
+
+    case PushPromise:
+        return fail(ProtocolError);
+
+    case Ping:
+        if (streamId != 0) return fail(ProtocolError);
+        if (size != 8) return fail(FrameSizeError);
+        if (!(flags & Ack)) queueFrame(Ping, Ack, 0, payload, size);
+        return true;
+
+    case GoAway:
+        if (streamId != 0) return fail(ProtocolError);
+        peerGoingAway = true;
+        return true;
+
+    case WindowUpdate:
+        return onWindowUpdate(streamId, payload, size);
+
+    case Continuation:
+        if (headerStreamId == 0) return fail(ProtocolError);
+        if (headerBlock.size() + size > options.maxRequestSize) return fail(EnhanceYourCalm);
+        headerBlock.append(payload, size);
+        if (flags & EndHeaders) return onHeaderBlock();
+        return true;
+
+    default:
+        // Unknown frame types must be ignored.
+        return true;
+    }
+}
+
+bool Http2Connection::onHeaders(uint8_t flags, uint32_t streamId, const char* payload, size_t size) {
+    if (streamId == 0) return fail(ProtocolError);
+
+    size_t begin = 0;
+    size_t end = size;
+    if (flags & Padded) {
+        if (size < 1) return fail(ProtocolError);
+        size_t padding = static_cast<uint8_t>(payload[0]);
+        begin = 1;
+        if (padding > end - begin) return fail(ProtocolError);
+        end -= padding;
+    }
+    if (flags & PriorityFlag) {
+        if (end - begin < 5) return fail(ProtocolError);
+        begin += 5;
+    }
+
+    headerStreamId = streamId;
+    headerFlags = flags;
+    headerBlock.assign(payload + begin, end - begin);
+
+    if (flags & EndHeaders) return onHeaderBlock();
+    return true;
+}
+
+bool Http2Connection::onHeaderBlock() {
+    uint32_t streamId = headerStreamId;
+    uint8_t flags = headerFlags;
+    headerStreamId = 0;
+
+    // Always decode, even for refused streams: HPACK state is per connection.
+    // The list is held to the SETTINGS_MAX_HEADER_LIST_SIZE we advertised.
+    HPACK::HeaderList fields;
+    HPACK::Decoder::Result decoded = decoder.decode(reinterpret_cast<const uint8_t*>(headerBlock.data()), headerBlock.size(), fields, options.maxRequestSize);
+    headerBlock.clear();
+    if (decoded == HPACK::Decoder::Result::Error) return fail(CompressionError);
+    const bool headersTooLarge = decoded == HPACK::Decoder::Result::TooLarge;
+
+    auto it = streams.find(streamId);
+    if (it != streams.end()) {
+        // Trailers: accepted and ignored, but they must end the stream.
+        std::shared_ptr<Stream> stream = it->second;
+        if (stream->remoteClosed) {
+            resetStream(streamId, StreamClosed);
+            return true;
+        }
+        if (!(flags & EndStream)) return fail(ProtocolError);
+        if (headersTooLarge) {
+            resetStream(streamId, CompressionError);
+            return true;
+        }
+
+        stream->remoteClosed = true;
+        startStream(stream);
+        return true;
+    }
+
+    if (streamId <= lastStreamId || streamId % 2 == 0) return fail(ProtocolError);
+    lastStreamId = streamId;
+
+    // Opened after our GOAWAY: never processed, safe for the client to retry.
+    if (goingAway) {
+        resetStream(streamId, RefusedStream);
+        return true;
+    }
+
+    if (streams.size() >= options.maxConcurrentStreams) {
+        resetStream(streamId, RefusedStream);
+        return true;
+    }
+
+    auto stream = std::make_shared<Stream>();
+    stream->id = streamId;
+    stream->sendWindow = peerInitialWindow;
+    if (headersTooLarge) {
+        // Answered with 431 once the request ends; its body is discarded.
+        stream->headersTooLarge = true;
+        stream->tooLarge = true;
+    } else if (!buildRequest(fields, stream->request)) {
+        resetStream(streamId, ProtocolError);
+        return true;
+    }
+    stream->request.clientIp = connection.ip;
+    stream->request.secure = connection.tls != nullptr;
+
+    streams[streamId] = stream;
+    if (flags & EndStream) {
+        stream->remoteClosed = true;
+        startStream(stream);
+    }
+    return true;
+}
+
+bool Http2Connection::onData(uint8_t flags, uint32_t streamId, const char* payload, size_t size) {
+    if (streamId == 0) return fail(ProtocolError);
+
+    size_t begin = 0;
+    size_t end = size;
+    if (flags & Padded) {
+        if (size < 1) return fail(ProtocolError);
+        size_t padding = static_cast<uint8_t>(payload[0]);
+        begin = 1;
+        if (padding > end - begin) return fail(ProtocolError);
+        end -= padding;
+    }
+
+    // The whole frame, padding included, counts against flow control. Credit
+    // is returned in bulk once half the window has been consumed.
+    unacknowledged += static_cast<uint32_t>(size);
+    if (unacknowledged >= receiveWindow / 2) {
+        queueWindowUpdate(0, unacknowledged);
+        unacknowledged = 0;
+    }
+
+    auto it = streams.find(streamId);
+    if (it == streams.end() || it->second->remoteClosed) {
+        if (streamId > lastStreamId) return fail(ProtocolError);
+        resetStream(streamId, StreamClosed);
+        return true;
+    }
+
+    std::shared_ptr<Stream> stream = it->second;
+    if (!stream->tooLarge) {
+        if (stream->request.body.size() + (end - begin) > options.maxRequestSize) {
+            stream->tooLarge = true;
+            stream->request.body.clear();
+        } else {
+            stream->request.body.append(payload + begin, end - begin);
+        }
+    }
+
+    if (flags & EndStream) {
+        stream->remoteClosed = true;
+        startStream(stream);
+        return true;
+    }
+
+    stream->unacknowledged += static_cast<uint32_t>(size);
+    if (stream->unacknowledged >= options.initialWindowSize / 2) {
+        queueWindowUpdate(streamId, stream->unacknowledged);
+        stream->unacknowledged = 0;
+    }
+    return true;
+}
+
+bool Http2Connection::onSettings(uint8_t flags, uint32_t streamId, const char* payload, size_t size) {
+    if (streamId != 0) return fail(ProtocolError);
+
+    if (flags & Ack) {
+        if (size != 0) return fail(FrameSizeError);
+        return true;
+    }
+
+    if (size % 6 != 0) return fail(FrameSizeError);
+    if (!applySettings(payload, size)) return false;
+
+    queueFrame(Settings, Ack, 0, nullptr, 0);
+    pumpData();
+    return true;
+}
+
+bool Http2Connection::applySettings(const char* payload, size_t size) {
+    for (size_t i = 0; i + 6 <= size; i += 6) {
+        uint16_t id = read16(payload + i);
+        uint32_t value = read32(payload + i + 2);
+
+        switch (id) {
+        case 0x1: // HEADER_TABLE_SIZE
+            encoder.setMaxTableSize(value);
+            break;
+        case 0x2: // ENABLE_PUSH
+            if (value > 1) return fail(ProtocolError);
+            break;
+        case 0x4: { // INITIAL_WINDOW_SIZE
+            if (value > MAX_WINDOW) return fail(FlowControlError);
+            int64_t delta = static_cast<int64_t>(value) - peerInitialWindow;
+            for (auto& [streamId, stream] : streams) {
+                stream->sendWindow += delta;
+                if (stream->sendWindow > MAX_WINDOW) return fail(FlowControlError);
+            }
+            peerInitialWindow = value;
+            break;
+        }
+        case 0x5: // MAX_FRAME_SIZE
+            if (value < 16384 || value > 16777215) return fail(ProtocolError);
+            peerMaxFrameSize = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool Http2Connection::onWindowUpdate(uint32_t streamId, const char* payload, size_t size) {
+    if (size != 4) return fail(FrameSizeError);
+    uint32_t increment = read32(payload) & MAX_WINDOW;
+
+    if (streamId == 0) {
+        if (increment == 0) return fail(ProtocolError);
+        sendWindow += increment;
+        if (sendWindow > MAX_WINDOW) return fail(FlowControlError);
+    } else {
+        auto it = streams.find(streamId);
+        if (it == streams.end()) return true;
+
+        if (increment == 0) {
+            resetStream(streamId, ProtocolError);
+            return true;
+        }
+        it->second->sendWindow += increment;
+        if (it->second->sendWindow > MAX_WINDOW) {
+            resetStream(streamId, FlowControlError);
+            return true;
+        }
+    }
+
+    pumpData();
+    return true;
+}
+
+bool Http2Connection::buildRequest(const HPACK::HeaderList& fields, Request& request) {
+    std::string target;
+    std::string authority;
+    std::string cookies;
+
+    try {
+        for (const auto& [name, value] : fields) {
+            if (!name.empty() && name[0] == ':') {
+                if (name == ":method") request.method = value;
+                else if (name == ":path") target = value;
+                else if (name == ":authority") authority = value;
+                continue;
+            }
+
+            // Connection-specific fields make the request malformed.
+            if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade") return false;
+
+            // Cookies may be split across several fields.
+            if (name == "cookie") {
+                if (!cookies.empty()) cookies += "; ";
+                cookies += value;
+                continue;
+            }
+
+            applyHeader(request, canonicalName(name), value);
+        }
+
+        if (!cookies.empty()) applyHeader(request, "Cookie", cookies);
+    } catch (...) {
+        return false;
+    }
+
+    if (request.method.empty() || target.empty()) return false;
+    if (!authority.empty() && request.headers.count("Host") == 0) request.headers["Host"] = authority;
+
+    request.protocol = "HTTP/2.0";
+    applyTarget(request, target);
+    return true;
+}
+
+void Http2Connection::startStream(std::shared_ptr<Stream> stream) {
+    if (stream->request.contentLength == 0) {
+        stream->request.contentLength = static_cast<int>(stream->request.body.size());
+    }
+
+    ++tasks;
+    spawn(dispatch(std::move(stream)));
+}
+
+Task<void> Http2Connection::dispatch(std::shared_ptr<Stream> stream) {
+    Response response;
+
+    if (stream->headersTooLarge) {
+        response.setStatus(HttpStatus::RequestHeaderFieldsTooLarge);
+    } else if (stream->tooLarge) {
+        response.setStatus(HttpStatus::PayloadTooLarge);
+    } else if (stream->answer) {
+        response = std::move(*stream->answer);
+    } else {
+        try {
+            response = co_await handler(stream->request);
+        } catch (const std::exception& e) {
+            std::cerr << "[!] [Http2] Stream " << stream->id << " handler threw: " << e.what() << std::endl;
+            response = Response();
+            response.setStatus(HttpStatus::InternalServerError);
+        }
+    }
+
+    if (!stream->reset && !broken) {
+        sendResponse(stream, response);
+    }
+    taskDone();
+}
+
+void Http2Connection::sendResponse(const std::shared_ptr<Stream>& stream, Response& response) {
+    bool hasBody = !response.body.empty() && stream->request.method != "HEAD";
+
+    HPACK::HeaderList fields;
+    fields.emplace_back(":status", std::to_string(response.statusCode));
+    fields.emplace_back("content-type", response.contentType);
+    fields.emplace_back("content-length", std::to_string(response.body.size()));
+    for (const auto& [key, value] : response.headers) {
+        std::string name = lowercase(key);
+        if (name == "content-type" || name == "content-length" || name == "connection" ||
+            name == "keep-alive" || name == "transfer-encoding" || name == "upgrade") continue;
+        fields.emplace_back(std::move(name), value);
+    }
+
+    std::string block;
+    encoder.encode(fields, block);
+
+    // HEADERS then CONTINUATION frames, each within the peer's frame size.
+    size_t offset = 0;
+    bool first = true;
+    do {
+        size_t length = std::min<size_t>(block.size() - offset, peerMaxFrameSize);
+        bool last = offset + length == block.size();
+
+        uint8_t flags = last ? EndHeaders : 0;
+        if (first && !hasBody) flags |= EndStream;
+
+        queueFrame(first ? Headers : Continuation, flags, stream->id, block.data() + offset, length);
+        offset += length;
+        first = false;
+    } while (offset < block.size());
+
+    if (!hasBody) {
+        closeStream(stream->id);
+        flush();
+        return;
+    }
+
+    stream->pendingData = std::move(response.body);
+    sending.push_back(stream);
+    pumpData();
+}
+
+void Http2Connection::pumpData() {
+    // Round-robin one frame per stream per pass so large responses do not
+    // starve small ones sharing the connection window.
+    bool progressed = true;
+    while (progressed && sendWindow > 0) {
+        progressed = false;
+
+        for (size_t n = sending.size(); n > 0 && sendWindow > 0; --n) {
+            std::shared_ptr<Stream> stream = std::move(sending.front());
+            sending.pop_front();
+            if (stream->reset) continue;
+
+            size_t remaining = stream->pendingData.size() - stream->dataOffset;
+            int64_t window = std::min(sendWindow, stream->sendWindow);
+            size_t length = std::min<size_t>(remaining, peerMaxFrameSize);
+            if (window <= 0) length = 0;
+            else length = std::min<size_t>(length, static_cast<size_t>(window));
+
+            if (length == 0) {
+                sending.push_back(std::move(stream));
+                continue;
+            }
+
+            bool last = length == remaining;
+            queueFrame(Data, last ? EndStream : 0, stream->id, stream->pendingData.data() + stream->dataOffset, length);
+            stream->dataOffset += length;
+            stream->sendWindow -= static_cast<int64_t>(length);
+            sendWindow -= static_cast<int64_t>(length);
+            progressed = true;
+
+            if (last) {
+                closeStream(stream->id);
+            } else {
+                sending.push_back(std::move(stream));
+            }
+        }
+    }
+
+    flush();
+}
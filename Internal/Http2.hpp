@@ -0,0 +1,192 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Connection.hpp"
+#include "Hpack.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Task.hpp"
+
+using namespace HTTP;
+
+// One HTTP/2 connection (RFC 7540): frames are read on the connection's loop,
+// every request stream is dispatched as its own coroutine, and responses are
+// interleaved frame by frame under the peer's flow-control windows. Frames
+// queued while processing a batch of input go out in a single write.
+class Http2Connection {
+public:
+    using Handler = std::function<Task<Response>(Request&)>;
+
+    static constexpr std::string_view PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    struct Options {
+        uint32_t maxConcurrentStreams = 256;
+        uint32_t initialWindowSize = 65535;
+        size_t maxRequestSize = 16 * 1024;
+        std::chrono::milliseconds bodyTimeout{ 10000 };
+        std::chrono::milliseconds writeTimeout{ 30000 };
+        std::function<std::chrono::milliseconds()> idleTimeout;
+    };
+
+    Http2Connection(Connection& connection, Handler handler, Options options)
+        : connection(connection), handler(std::move(handler)), options(std::move(options)) {
+    }
+
+    Http2Connection(const Http2Connection&) = delete;
+    Http2Connection& operator=(const Http2Connection&) = delete;
+
+    // input holds bytes already read from the client, starting with the
+    // connection preface. For an h2c upgrade, upgraded is the HTTP/1.1 request
+    // (served as stream 1), answer its response if it was answered before the
+    // switch, and settings the raw HTTP2-Settings header value.
+    // Completes once the client is gone and every stream has finished.
+    Task<void> run(std::string input, std::unique_ptr<Request> upgraded = nullptr, const std::string& settings = std::string(),
+        std::unique_ptr<Response> answer = nullptr);
+
+    // Loop thread only. Sends GOAWAY with the last stream accepted: open
+    // streams finish, new ones are refused, and the connection closes once it
+    // is idle. May be called before run() has started.
+    void goAway();
+
+private:
+    enum FrameType : uint8_t {
+        Data = 0x0,
+        Headers = 0x1,
+        Priority = 0x2,
+        RstStream = 0x3,
+        Settings = 0x4,
+        PushPromise = 0x5,
+        Ping = 0x6,
+        GoAway = 0x7,
+        WindowUpdate = 0x8,
+        Continuation = 0x9
+    };
+
+    enum FrameFlags : uint8_t {
+        EndStream = 0x1,
+        Ack = 0x1,
+        EndHeaders = 0x4,
+        Padded = 0x8,
+        PriorityFlag = 0x20
+    };
+
+    enum ErrorCode : uint32_t {
+        NoError = 0x0,
+        ProtocolError = 0x1,
+        InternalError = 0x2,
+        FlowControlError = 0x3,
+        StreamClosed = 0x5,
+        FrameSizeError = 0x6,
+        RefusedStream = 0x7,
+        CompressionError = 0x9,
+        EnhanceYourCalm = 0xb
+    };
+
+    static constexpr uint32_t DEFAULT_WINDOW = 65535;
+    static constexpr uint32_t MAX_WINDOW = 0x7FFFFFFF;
+    static constexpr uint32_t MAX_FRAME_SIZE = 16384;
+
+    struct Stream {
+        uint32_t id = 0;
+        Request request;
+        bool remoteClosed = false;
+        bool reset = false;
+        bool tooLarge = false;
+        bool headersTooLarge = false;
+        std::unique_ptr<Response> answer;   // already answered, not dispatched
+        int64_t sendWindow = DEFAULT_WINDOW;
+        uint32_t unacknowledged = 0;
+
+        std::string pendingData;
+        size_t dataOffset = 0;
+    };
+
+    struct DrainAwaiter {
+        Http2Connection& owner;
+
+        bool await_ready() const noexcept {
+            return owner.tasks == 0;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            owner.drained = handle;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    Connection& connection;
+    Handler handler;
+    Options options;
+
+    HPACK::Encoder encoder;
+    HPACK::Decoder decoder;
+
+    std::unordered_map<uint32_t, std::shared_ptr<Stream>> streams;
+    std::deque<std::shared_ptr<Stream>> sending;
+    uint32_t lastStreamId = 0;
+    bool peerGoingAway = false;
+    bool goingAway = false;
+    bool started = false;   // our SETTINGS are queued; frames may follow
+
+    int64_t sendWindow = DEFAULT_WINDOW;
+    int64_t peerInitialWindow = DEFAULT_WINDOW;
+    uint32_t peerMaxFrameSize = MAX_FRAME_SIZE;
+    uint32_t receiveWindow = DEFAULT_WINDOW;
+    uint32_t unacknowledged = 0;
+
+    // Header block being reassembled from HEADERS + CONTINUATION frames.
+    uint32_t headerStreamId = 0;
+    uint8_t headerFlags = 0;
+    std::string headerBlock;
+
+    std::string outbox;
+    bool writing = false;
+    bool broken = false;
+
+    // Stream handlers and the writer still running; run() waits for them.
+    size_t tasks = 0;
+    std::coroutine_handle<> drained;
+
+    ErrorCode error = NoError;
+
+    bool fail(ErrorCode code) {
+        error = code;
+        return false;
+    }
+
+    void queueFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t size);
+    void queueWindowUpdate(uint32_t streamId, uint32_t increment);
+    void resetStream(uint32_t streamId, ErrorCode code);
+    void sendGoAway();
+    void closeStream(uint32_t streamId);
+
+    void flush();
+    Task<void> writer();
+    void taskDone();
+    void updateDeadline();
+
+    bool processFrame(uint8_t type, uint8_t flags, uint32_t streamId, const char* payload, size_t size);
+    bool onHeaders(uint8_t flags, uint32_t streamId, const char* payload, size_t size);
+    bool onHeaderBlock();
+    bool onData(uint8_t flags, uint32_t streamId, const char* payload, size_t size);
+    bool onSettings(uint8_t flags, uint32_t streamId, const char* payload, size_t size);
+    bool onWindowUpdate(uint32_t streamId, const char* payload, size_t size);
+    bool applySettings(const char* payload, size_t size);
+
+    static bool buildRequest(const HPACK::HeaderList& fields, Request& request);
+
+    void startStream(std::shared_ptr<Stream> stream);
+    Task<void> dispatch(std::shared_ptr<Stream> stream);
+    void sendResponse(const std::shared_ptr<Stream>& stream, Response& response);
+    void pumpData();
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Task.hpp"
+
+using namespace HTTP;
+
+// Cross-cutting request logic. A middleware is any callable
+//
+//     template <typename Next> Task<Response> operator()(Request& req, Next& next)
+//
+// that either answers the request itself or calls next(req) to run the rest of
+// the chain, before and/or after which it may inspect or change the request
+// and response. A layer that only acts on the way in can return next(req)
+// without being a coroutine (see RateLimit) and adds no frame of its own. One
+// that changes the response has to await next(req), so it is a coroutine and
+// costs one frame per request (RequestId, Cors).
+namespace Middleware {
+    using Endpoint = std::function<Task<Response>(Request&)>;
+
+    namespace Detail {
+        inline Task<Response> ready(Response response) {
+            co_return response;
+        }
+
+        // Calls a route handler, synchronous or coroutine.
+        template <typename Handler>
+        Task<Response> invoke(Handler& handler, Request& req) {
+            if constexpr (std::is_same_v<std::invoke_result_t<Handler&, Request&>, Task<Response>>) {
+                return handler(req);
+            } else {
+                return ready(handler(req));
+            }
+        }
+    }
+
+    // Compile-time chain: Chain<Handler, A, B> runs A, then B, then the handler.
+    // Each layer sees the rest of the chain as its concrete type, so calls
+    // between layers are direct rather than through std::function; only the
+    // route itself is stored behind one.
+    template <typename Handler, typename... Layers>
+    class Chain;
+
+    template <typename Handler>
+    class Chain<Handler> {
+    private:
+        Handler handler;
+
+    public:
+        explicit Chain(Handler handler) : handler(std::move(handler)) {
+        }
+
+        Task<Response> operator()(Request& req) {
+            return Detail::invoke(handler, req);
+        }
+    };
+
+    template <typename Handler, typename Layer, typename... Rest>
+    class Chain<Handler, Layer, Rest...> {
+    private:
+        Layer layer;
+        Chain<Handler, Rest...> next;
+
+    public:
+        Chain(Handler handler, Layer layer, Rest... rest)
+            : layer(std::move(layer)), next(std::move(handler), std::move(rest)...) {
+        }
+
+        Task<Response> operator()(Request& req) {
+            return layer(req, next);
+        }
+    };
+
+    // chain(handler, outermost, ..., innermost)
+    template <typename Handler, typename... Layers>
+    Chain<Handler, Layers...> chain(Handler handler, Layers... layers) {
+        return Chain<Handler, Layers...>(std::move(handler), std::move(layers)...);
+    }
+
+    // Runtime chain, for layers added while the program runs (Router::use). Any
+    // compile-time middleware fits, instantiated with Next.
+    class Next;
+    using Layer = std::function<Task<Response>(Request&, Next&)>;
+
+    class Next {
+    private:
+        const std::vector<Layer>& layers;
+        const Endpoint& endpoint;
+        size_t index;
+
+    public:
+        Next(const std::vector<Layer>& layers, const Endpoint& endpoint, size_t index = 0)
+            : layers(layers), endpoint(endpoint), index(index) {
+        }
+
+        Task<Response> operator()(Request& req) {
+            if (index == layers.size()) {
+                co_return co_await endpoint(req);
+            }
+
+            // Lives in this frame for as long as the layer may call it.
+            Next after(layers, endpoint, index + 1);
+            co_return co_await layers[index](req, after);
+        }
+    };
+
+    // Tags every request with an ID, reusing the client's X-Request-Id when it
+    // sends one, and echoes it on the response.
+    class RequestId {
+    public:
+        template <typename Next>
+        Task<Response> operator()(Request& req, Next& next) {
+            auto incoming = req.headers.find("X-Request-Id");
+            std::string id = incoming != req.headers.end() && !incoming->second.empty() ? incoming->second : generate();
+            req.headers["X-Request-Id"] = id;
+
+            Response response = co_await next(req);
+            response.setHeader("X-Request-Id", id);
+            co_return response;
+        }
+
+    private:
+        static std::string generate() {
+            static const DWORD process = GetCurrentProcessId();
+            static std::atomic<uint64_t> counter{ 0 };
+
+            std::ostringstream id;
+            id << std::hex << std::setfill('0') << std::setw(8) << process << "-" << std::setw(12) << counter.fetch_add(1, std::memory_order_relaxed);
+            return id.str();
+        }
+    };
+
+    // Cross-origin access for the given origin ("*" for any). Answers preflight
+    // OPTIONS requests directly. Preflights match no route, so only a global
+    // Cors (Router::use) ever sees them.
+    class Cors {
+    private:
+        std::string origin;
+        std::string methods;
+        std::string headers;
+
+    public:
+        explicit Cors(std::string origin = "*", std::string methods = "GET, POST, PUT, DELETE, PATCH, OPTIONS", std::string headers = "Content-Type, Authorization")
+            : origin(std::move(origin)), methods(std::move(methods)), headers(std::move(headers)) {
+        }
+
+        template <typename Next>
+        Task<Response> operator()(Request& req, Next& next) {
+            if (req.method == "OPTIONS" && req.headers.count("Access-Control-Request-Method")) {
+                Response preflight;
+                preflight.setStatus(HttpStatus::NoContent)
+                    .setHeader("Access-Control-Allow-Origin", origin)
+                    .setHeader("Access-Control-Allow-Methods", methods)
+                    .setHeader("Access-Control-Allow-Headers", headers)
+                    .setHeader("Access-Control-Max-Age", "600");
+                co_return preflight;
+            }
+
+            Response response = co_await next(req);
+            response.setHeader("Access-Control-Allow-Origin", origin);
+            if (origin != "*") {
+                auto vary = response.headers.find("Vary");
+                response.setHeader("Vary", vary == response.headers.end() || vary->second.empty() ? "Origin" : vary->second + ", Origin");
+            }
+            co_return response;
+        }
+    };
+}
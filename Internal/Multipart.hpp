@@ -0,0 +1,420 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <array>
+#include <atomic>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "Request.hpp"
+#include "Task.hpp"
+#include "EventLoop.hpp"
+
+using namespace HTTP;
+
+// Incremental multipart/form-data parser (RFC 7578). Bytes are fed in as they
+// arrive and events are pulled with next(); data events point into the
+// parser's own buffer, which only ever holds the unconsumed tail, so memory
+// stays bounded by the largest chunk fed in however big the parts are.
+class MultipartParser {
+public:
+    enum class Event {
+        NeedMore,   // feed more input
+        PartBegin,  // part() describes the new part
+        Data,       // data() holds the next piece of the current part
+        PartEnd,
+        Done,       // closing boundary seen
+        Error
+    };
+
+    struct Part {
+        std::string name;
+        std::string filename;
+        std::string contentType;
+        bool isFile = false;
+    };
+
+    // The boundary parameter of a multipart/form-data Content-Type, or empty.
+    static std::string boundaryOf(const std::string& contentType) {
+        if (_strnicmp(contentType.c_str(), "multipart/form-data", 19) != 0) return std::string();
+
+        size_t pos = contentType.find("boundary=");
+        if (pos == std::string::npos) return std::string();
+
+        std::string boundary = contentType.substr(pos + 9);
+        if (!boundary.empty() && boundary.front() == '"') {
+            size_t end = boundary.find('"', 1);
+            boundary = end == std::string::npos ? std::string() : boundary.substr(1, end - 1);
+        } else {
+            boundary = boundary.substr(0, boundary.find_first_of("; \t"));
+        }
+
+        return boundary.size() <= 70 ? boundary : std::string();
+    }
+
+    explicit MultipartParser(const std::string& boundary) : delimiter("\r\n--" + boundary) {
+        // Horspool shift table for the delimiter's last byte.
+        skip.fill(delimiter.size());
+        for (size_t i = 0; i + 1 < delimiter.size(); ++i) {
+            skip[static_cast<unsigned char>(delimiter[i])] = delimiter.size() - 1 - i;
+        }
+
+        // The first boundary has no preceding CRLF; supply one so every
+        // boundary matches the same delimiter.
+        buffer = "\r\n";
+    }
+
+    // Invalidates the last data().
+    void feed(const char* data, size_t size) {
+        if (position > 0) {
+            buffer.erase(0, position);
+            position = 0;
+        }
+        buffer.append(data, size);
+    }
+
+    Event next() {
+        while (true) {
+            switch (state) {
+            case State::Preamble: {
+                size_t found = search(position);
+                if (found == std::string::npos) {
+                    // Keep only what could still be the start of the delimiter.
+                    if (buffer.size() - position >= delimiter.size()) position = buffer.size() - delimiter.size() + 1;
+                    return Event::NeedMore;
+                }
+                position = found + delimiter.size();
+                state = State::AfterBoundary;
+                break;
+            }
+
+            case State::AfterBoundary: {
+                // Transport padding may follow the boundary before its CRLF.
+                while (position < buffer.size() && (buffer[position] == ' ' || buffer[position] == '\t')) ++position;
+                if (buffer.size() - position < 2) return Event::NeedMore;
+
+                if (buffer.compare(position, 2, "--") == 0) {
+                    position = buffer.size();
+                    state = State::Epilogue;
+                    return Event::Done;
+                }
+                if (buffer.compare(position, 2, "\r\n") != 0) return fail();
+
+                position += 2;
+                state = State::Headers;
+                break;
+            }
+
+            case State::Headers: {
+                size_t end;
+                if (buffer.compare(position, 2, "\r\n") == 0) {
+                    end = position;
+                } else {
+                    end = buffer.find("\r\n\r\n", position);
+                    if (end == std::string::npos) {
+                        return buffer.size() - position > MAX_HEADER_SIZE ? fail() : Event::NeedMore;
+                    }
+                    end += 2;
+                }
+                if (end - position > MAX_HEADER_SIZE) return fail();
+
+                if (!parseHeaders(std::string_view(buffer).substr(position, end - position))) return fail();
+                position = end + 2;
+                state = State::Body;
+                return Event::PartBegin;
+            }
+
+            case State::Body: {
+                size_t found = search(position);
+                if (found == position) {
+                    position += delimiter.size();
+                    state = State::AfterBoundary;
+                    return Event::PartEnd;
+                }
+
+                // Everything before a possible delimiter start is part data.
+                size_t safe = found != std::string::npos ? found
+                    : buffer.size() >= delimiter.size() ? buffer.size() - delimiter.size() + 1 : 0;
+                if (safe <= position) return Event::NeedMore;
+
+                current = std::string_view(buffer).substr(position, safe - position);
+                position = safe;
+                return Event::Data;
+            }
+
+            case State::Epilogue:
+                position = buffer.size();
+                return Event::Done;
+
+            case State::Failed:
+                return Event::Error;
+            }
+        }
+    }
+
+    const Part& part() const {
+        return currentPart;
+    }
+
+    std::string_view data() const {
+        return current;
+    }
+
+private:
+    enum class State { Preamble, AfterBoundary, Headers, Body, Epilogue, Failed };
+
+    static constexpr size_t MAX_HEADER_SIZE = 8 * 1024;
+
+    std::string delimiter;
+    std::array<size_t, 256> skip;
+
+    std::string buffer;
+    size_t position = 0;
+    State state = State::Preamble;
+
+    Part currentPart;
+    std::string_view current;
+
+    Event fail() {
+        state = State::Failed;
+        return Event::Error;
+    }
+
+    // Boyer-Moore-Horspool: compare from the end of the window and shift by the
+    // table entry of its last byte, skipping most of the input untouched.
+    size_t search(size_t from) const {
+        const size_t length = delimiter.size();
+        const size_t last = length - 1;
+        const char* data = buffer.data();
+
+        size_t i = from;
+        while (i + length <= buffer.size()) {
+            unsigned char tail = static_cast<unsigned char>(data[i + last]);
+            if (tail == static_cast<unsigned char>(delimiter[last]) && memcmp(data + i, delimiter.data(), last) == 0) {
+                return i;
+            }
+            i += skip[tail];
+        }
+        return std::string::npos;
+    }
+
+    static std::string unquote(std::string_view value) {
+        if (value.size() < 2 || value.front() != '"' || value.back() != '"') return std::string(value);
+
+        std::string result;
+        for (size_t i = 1; i + 1 < value.size(); ++i) {
+            if (value[i] == '\\' && i + 2 < value.size()) ++i;
+            result += value[i];
+        }
+        return result;
+    }
+
+    static std::string_view trim(std::string_view value) {
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+        return value;
+    }
+
+    bool parseHeaders(std::string_view block) {
+        currentPart = Part();
+        bool disposition = false;
+
+        while (!block.empty()) {
+            size_t lineEnd = block.find("\r\n");
+            std::string_view line = block.substr(0, lineEnd);
+            block.remove_prefix(lineEnd == std::string_view::npos ? block.size() : lineEnd + 2);
+
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) return false;
+            std::string name(trim(line.substr(0, colon)));
+            std::string_view value = trim(line.substr(colon + 1));
+
+            if (_stricmp(name.c_str(), "Content-Type") == 0) {
+                currentPart.contentType = std::string(value);
+            } else if (_stricmp(name.c_str(), "Content-Disposition") == 0) {
+                size_t semicolon = value.find(';');
+                if (_stricmp(std::string(trim(value.substr(0, semicolon))).c_str(), "form-data") != 0) return false;
+                disposition = true;
+
+                while (semicolon != std::string_view::npos) {
+                    value.remove_prefix(semicolon + 1);
+                    semicolon = value.find(';');
+
+                    // Quoted values may contain ';' themselves.
+                    size_t quote = value.find('"');
+                    if (quote != std::string_view::npos && (semicolon == std::string_view::npos || quote < semicolon)) {
+                        size_t close = quote + 1;
+                        while (close < value.size() && value[close] != '"') close += value[close] == '\\' ? 2 : 1;
+                        semicolon = value.find(';', close);
+                    }
+
+                    std::string_view param = trim(value.substr(0, semicolon));
+                    size_t eq = param.find('=');
+                    if (eq == std::string_view::npos) continue;
+
+                    std::string key(trim(param.substr(0, eq)));
+                    if (_stricmp(key.c_str(), "name") == 0) {
+                        currentPart.name = unquote(trim(param.substr(eq + 1)));
+                    } else if (_stricmp(key.c_str(), "filename") == 0) {
+                        currentPart.filename = unquote(trim(param.substr(eq + 1)));
+                        currentPart.isFile = true;
+                    }
+                }
+            }
+        }
+
+        return disposition;
+    }
+};
+
+// Drives a MultipartParser for one request: form fields are collected into
+// req.form, file parts are written to new files in directory as they arrive
+// and listed in req.files. With req.onPart set, every part goes to it instead. Field values and every part's name, file name and
+// content type together are limited to maxFieldBytes, and a body to MAX_PARTS
+// parts. Writes are
+// overlapped on the request's loop. Files of an upload that does not finish
+// are removed again.
+class MultipartUpload {
+public:
+    MultipartUpload(EventLoop& loop, Request& req, const std::string& boundary, size_t maxFieldBytes, std::filesystem::path directory)
+        : loop(loop), req(req), parser(boundary), maxFieldBytes(maxFieldBytes), directory(std::move(directory)) {
+    }
+
+    MultipartUpload(const MultipartUpload&) = delete;
+    MultipartUpload& operator=(const MultipartUpload&) = delete;
+
+    ~MultipartUpload() {
+        closeFile();
+        if (state == Result::Done) return;
+
+        for (size_t i = firstFile; i < req.files.size(); ++i) {
+            std::error_code ec;
+            std::filesystem::remove(req.files[i].path, ec);
+        }
+        req.files.resize(firstFile);
+    }
+
+    enum class Result { Continue, Done, Error };
+
+    static constexpr size_t MAX_PARTS = 256;
+
+    // Consumes one chunk of the body. Done once the closing boundary was seen.
+    Task<Result> feed(const char* data, size_t size) {
+        if (state != Result::Continue) co_return state;
+
+        parser.feed(data, size);
+        while (true) {
+            switch (parser.next()) {
+            case MultipartParser::Event::NeedMore:
+                co_return state;
+
+            case MultipartParser::Event::PartBegin:
+                if (!beginPart()) co_return state = Result::Error;
+                break;
+
+            case MultipartParser::Event::Data: {
+                std::string_view chunk = parser.data();
+                if (req.onPart) {
+                    if (!co_await req.onPart(streamed, chunk, false)) co_return state = Result::Error;
+                    streamed.size += chunk.size();
+                    break;
+                }
+                if (file == INVALID_HANDLE_VALUE) {
+                    fieldBytes += chunk.size();
+                    if (fieldBytes > maxFieldBytes) co_return state = Result::Error;
+                    value.append(chunk);
+                    break;
+                }
+
+                UploadedFile& upload = req.files.back();
+                while (!chunk.empty()) {
+                    int written = co_await loop.write(file, upload.size, chunk.data(), chunk.size());
+                    if (written <= 0) co_return state = Result::Error;
+                    upload.size += written;
+                    chunk.remove_prefix(written);
+                }
+                break;
+            }
+
+            case MultipartParser::Event::PartEnd:
+                if (req.onPart) {
+                    if (!co_await req.onPart(streamed, std::string_view(), true)) co_return state = Result::Error;
+                } else if (file != INVALID_HANDLE_VALUE) {
+                    closeFile();
+                } else if (!name.empty()) {
+                    req.form[name] = std::move(value);
+                }
+                value.clear();
+                break;
+
+            case MultipartParser::Event::Done:
+                co_return state = Result::Done;
+
+            case MultipartParser::Event::Error:
+                co_return state = Result::Error;
+            }
+        }
+    }
+
+private:
+    EventLoop& loop;
+    Request& req;
+    MultipartParser parser;
+    size_t maxFieldBytes;
+    std::filesystem::path directory;
+
+    Result state = Result::Continue;
+    size_t firstFile = req.files.size();
+    size_t fieldBytes = 0;
+    size_t parts = 0;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::string name;
+    std::string value;
+    UploadedFile streamed;
+
+    bool beginPart() {
+        const MultipartParser::Part& part = parser.part();
+        fieldBytes += part.name.size() + part.filename.size() + part.contentType.size();
+        if (++parts > MAX_PARTS || fieldBytes > maxFieldBytes) return false;
+
+        if (req.onPart) {
+            streamed = { part.name, part.filename, part.contentType, std::filesystem::path(), 0 };
+            return true;
+        }
+
+        name = part.name;
+        if (!part.isFile) return true;
+
+        static std::atomic<uint64_t> counter{ 0 };
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+
+        // Client file names never touch the disk; the handler decides where
+        // the file ends up.
+        std::filesystem::path path = directory / ("upload-" + std::to_string(GetCurrentProcessId()) + "-" + std::to_string(counter.fetch_add(1)) + ".part");
+        file = CreateFileW(path.wstring().c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            std::cout << "[!] [Multipart] Unable to create " << path.string() << ": " << GetLastError() << std::endl;
+            return false;
+        }
+        if (!loop.attach(file)) {
+            closeFile();
+            std::filesystem::remove(path, ec);
+            return false;
+        }
+
+        req.files.push_back({ part.name, part.filename, part.contentType, path, 0 });
+        return true;
+    }
+
+    void closeFile() {
+        if (file == INVALID_HANDLE_VALUE) return;
+        CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+    }
+};
@@ -0,0 +1,777 @@
+#include <WS2tcpip.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+#include "Proxy.hpp"
+#include "Compression.hpp"
+
+namespace {
+    // Where an upstream response body ends: after no bytes, a fixed length,
+    // the last chunk, or when the upstream closes.
+    class BodyFraming {
+    public:
+        enum class Kind { None, Length, Chunked, Close };
+
+        BodyFraming(Kind kind, uint64_t length) : kind(kind), remaining(length) {
+        }
+
+        // Bytes of data[0, size) that belong to the body; decoded receives the
+        // payload without chunk framing.
+        size_t take(const char* data, size_t size, std::string* decoded) {
+            size_t taken = 0;
+            switch (kind) {
+            case Kind::None:
+                break;
+            case Kind::Length:
+                taken = static_cast<size_t>(std::min<uint64_t>(remaining, size));
+                remaining -= taken;
+                if (decoded) decoded->append(data, taken);
+                break;
+            case Kind::Chunked:
+                taken = chunks.scan(data, size, decoded);
+                break;
+            case Kind::Close:
+                taken = size;
+                if (decoded) decoded->append(data, size);
+                break;
+            }
+            return taken;
+        }
+
+        bool complete() const {
+            switch (kind) {
+            case Kind::None: return true;
+            case Kind::Length: return remaining == 0;
+            case Kind::Chunked: return chunks.done();
+            default: return false;
+            }
+        }
+
+        bool failed() const {
+            return kind == Kind::Chunked && chunks.failed();
+        }
+
+        bool untilClose() const {
+            return kind == Kind::Close;
+        }
+
+    private:
+        Kind kind;
+        uint64_t remaining;
+        ChunkedScanner chunks;
+    };
+
+    bool containsToken(std::string value, const char* token) {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return value.find(token) != std::string::npos;
+    }
+
+    // The upstream dropped the connection, as opposed to the read timing out.
+    bool closedByPeer(int error) {
+        return error == WSAECONNRESET || error == WSAECONNABORTED || error == ERROR_NETNAME_DELETED;
+    }
+
+    std::string trim(const std::string& value) {
+        size_t begin = value.find_first_not_of(" \t");
+        if (begin == std::string::npos) return std::string();
+        return value.substr(begin, value.find_last_not_of(" \t") - begin + 1);
+    }
+
+    // The options of every Connection header in headers: names of further
+    // headers that are for this hop only (RFC 9110 7.6.1).
+    template <typename Headers>
+    std::vector<std::string> connectionOptions(const Headers& headers) {
+        std::vector<std::string> options;
+        for (const auto& [name, value] : headers) {
+            if (_stricmp(name.c_str(), "Connection") != 0) continue;
+
+            size_t start = 0;
+            while (start <= value.size()) {
+                size_t comma = value.find(',', start);
+                if (comma == std::string::npos) comma = value.size();
+                std::string option = trim(value.substr(start, comma - start));
+                if (!option.empty()) options.push_back(std::move(option));
+                start = comma + 1;
+            }
+        }
+        return options;
+    }
+
+    bool listed(const std::vector<std::string>& options, const std::string& name) {
+        return std::any_of(options.begin(), options.end(), [&name](const std::string& option) {
+            return _stricmp(option.c_str(), name.c_str()) == 0;
+        });
+    }
+
+    // Answers the client when the upstream never produced a response. The
+    // connection closes: part of the request body may still be unread.
+    std::string errorHead(HttpStatus status) {
+        return "HTTP/1.1 " + std::to_string(static_cast<int>(status)) + " " + reasonPhrase(status) + "\r\n"
+            "Content-Type: text/html\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+}
+
+UpstreamPool::UpstreamPool(std::string name, const UpstreamSettings& settings, const std::vector<EventLoop*>& loops)
+    : name(std::move(name)), settings(settings) {
+
+    for (const std::string& server : settings.servers) {
+        size_t colon = server.rfind(':');
+        std::string host = server.substr(0, colon);
+        std::string port = server.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_protocol = IPPROTO_TCP;
+
+        addrinfo* result = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || result == nullptr) {
+            std::cout << "[!] [Proxy] Unable to resolve " << server << " for upstream " << this->name << ", skipping it." << std::endl;
+            continue;
+        }
+
+        auto entry = std::make_unique<Server>();
+        entry->name = server;
+        memcpy(&entry->address, result->ai_addr, sizeof(entry->address));
+        freeaddrinfo(result);
+        servers.push_back(std::move(entry));
+    }
+
+    for (EventLoop* loop : loops) {
+        idle[loop];
+    }
+
+    // Extension functions are per provider, not per socket; any TCP socket will do.
+    SOCKET probe = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    GUID connectExId = WSAID_CONNECTEX;
+    DWORD bytes = 0;
+    if (probe == INVALID_SOCKET ||
+        WSAIoctl(probe, SIO_GET_EXTENSION_FUNCTION_POINTER, &connectExId, sizeof(connectExId), &connectEx, sizeof(connectEx), &bytes, nullptr, nullptr) != 0) {
+        connectEx = nullptr;
+        std::cout << "[!] [Proxy] Unable to load ConnectEx, upstream " << this->name << " is unavailable." << std::endl;
+    }
+    if (probe != INVALID_SOCKET) closesocket(probe);
+}
+
+UpstreamPool::~UpstreamPool() {
+    *running = false;
+    for (auto& [loop, list] : idle) {
+        for (const Idle& connection : list) {
+            closesocket(connection.socket);
+        }
+    }
+}
+
+int64_t UpstreamPool::nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool UpstreamPool::stillOpen(SOCKET socket) {
+    // An idle upstream has nothing to say: data or EOF means it has closed or
+    // is about to, and the connection must not carry another request.
+    char byte;
+    return ::recv(socket, &byte, 1, MSG_PEEK) == SOCKET_ERROR && WSAGetLastError() == WSAEWOULDBLOCK;
+}
+
+UpstreamPool::Server* UpstreamPool::pick() {
+    if (servers.empty()) return nullptr;
+
+    const int64_t now = nowMs();
+    auto usable = [now](const Server& server) {
+        return server.healthy.load(std::memory_order_relaxed) && server.retryAt.load(std::memory_order_relaxed) <= now;
+    };
+
+    size_t start = nextServer.fetch_add(1, std::memory_order_relaxed);
+
+    if (settings.balance == "least-connections") {
+        // Ties rotate, as in Server::pickLoop.
+        Server* best = nullptr;
+        for (size_t i = 0; i < servers.size(); ++i) {
+            Server* candidate = servers[(start + i) % servers.size()].get();
+            if (!usable(*candidate)) continue;
+            if (best == nullptr || candidate->active.load(std::memory_order_relaxed) < best->active.load(std::memory_order_relaxed)) {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    for (size_t i = 0; i < servers.size(); ++i) {
+        Server* candidate = servers[(start + i) % servers.size()].get();
+        if (usable(*candidate)) return candidate;
+    }
+    return nullptr;
+}
+
+void UpstreamPool::markDown(Server& server) {
+    int64_t now = nowMs();
+    int64_t previous = server.retryAt.exchange(now + settings.healthInterval, std::memory_order_relaxed);
+    if (previous <= now) {
+        std::cout << "[!] [Proxy] " << name << ": " << server.name << " unreachable, retrying in " << settings.healthInterval << " ms." << std::endl;
+    }
+}
+
+Task<SOCKET> UpstreamPool::connect(EventLoop& loop, Server& server) {
+    if (connectEx == nullptr) co_return INVALID_SOCKET;
+
+    SOCKET socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    if (socket == INVALID_SOCKET) co_return INVALID_SOCKET;
+
+    // ConnectEx only takes bound sockets.
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+    local.sin_port = 0;
+
+    u_long nonBlocking = 1;
+    BOOL noDelay = TRUE;
+    if (bind(socket, reinterpret_cast<const sockaddr*>(&local), sizeof(local)) != 0 || !loop.attach(socket) ||
+        ioctlsocket(socket, FIONBIO, &nonBlocking) != 0) {
+        closesocket(socket);
+        co_return INVALID_SOCKET;
+    }
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+    if (!co_await loop.connect(connectEx, socket, server.address, std::chrono::milliseconds(settings.connectTimeout))) {
+        closesocket(socket);
+        co_return INVALID_SOCKET;
+    }
+    co_return socket;
+}
+
+Task<UpstreamPool::Lease> UpstreamPool::acquire(EventLoop& loop) {
+    std::vector<Idle>& list = idle.find(&loop)->second;
+
+    for (size_t attempt = 0; attempt < servers.size(); ++attempt) {
+        Server* server = pick();
+        if (server == nullptr) break;
+
+        // Most recently returned first: the least likely to have timed out.
+        for (size_t i = list.size(); i-- > 0;) {
+            if (list[i].server != server) continue;
+
+            SOCKET socket = list[i].socket;
+            list.erase(list.begin() + i);
+            if (!stillOpen(socket)) {
+                closesocket(socket);
+                continue;
+            }
+
+            server->active.fetch_add(1, std::memory_order_relaxed);
+            co_return Lease{ socket, server, true };
+        }
+
+        server->active.fetch_add(1, std::memory_order_relaxed);
+        SOCKET socket = co_await connect(loop, *server);
+        if (socket != INVALID_SOCKET) {
+            co_return Lease{ socket, server, false };
+        }
+
+        server->active.fetch_sub(1, std::memory_order_relaxed);
+        markDown(*server);
+    }
+
+    co_return Lease{};
+}
+
+void UpstreamPool::release(EventLoop& loop, Lease& lease, bool reusable) {
+    if (!lease) return;
+    lease.server->active.fetch_sub(1, std::memory_order_relaxed);
+
+    std::vector<Idle>& list = idle.find(&loop)->second;
+    size_t parked = std::count_if(list.begin(), list.end(), [&lease](const Idle& connection) {
+        return connection.server == lease.server;
+    });
+
+    if (reusable && parked < static_cast<size_t>(settings.maxIdle)) {
+        list.push_back({ lease.socket, lease.server });
+    } else {
+        closesocket(lease.socket);
+    }
+    lease.socket = INVALID_SOCKET;
+}
+
+void UpstreamPool::startHealthChecks(EventLoop& loop) {
+    if (settings.healthPath.empty() || servers.empty()) return;
+
+    loop.post([this, &loop, running = running]() {
+        spawn(healthLoop(loop, running));
+    });
+}
+
+Task<void> UpstreamPool::healthLoop(EventLoop& loop, std::shared_ptr<std::atomic<bool>> running) {
+    // running outlives the pool, so the loop can tell when to stop without
+    // touching it.
+    while (*running) {
+        for (size_t i = 0; i < servers.size(); ++i) {
+            Server& server = *servers[i];
+            bool up = co_await probe(loop, server);
+            if (!*running) co_return;
+
+            if (up) server.retryAt.store(0, std::memory_order_relaxed);
+            if (server.healthy.exchange(up, std::memory_order_relaxed) != up) {
+                std::cout << (up ? "[*] [Proxy] " : "[!] [Proxy] ") << name << ": " << server.name << (up ? " is healthy again." : " failed its health check.") << std::endl;
+            }
+        }
+        co_await loop.sleep(std::chrono::milliseconds(settings.healthInterval));
+    }
+}
+
+Task<bool> UpstreamPool::probe(EventLoop& loop, Server& server) {
+    const std::string request = "GET " + settings.healthPath + " HTTP/1.1\r\nHost: " + server.name + "\r\nConnection: close\r\n\r\n";
+    const std::chrono::milliseconds timeout(settings.healthTimeout);
+
+    SOCKET socket = co_await connect(loop, server);
+    if (socket == INVALID_SOCKET) co_return false;
+
+    // Any 2xx or 3xx status line counts; the rest of the response is not read.
+    std::string response;
+    bool up = false;
+    if (co_await loop.sendAll(socket, request, std::string(), timeout)) {
+        while (response.find("\r\n") == std::string::npos && response.size() < 1024) {
+            if (co_await loop.receive(socket, response, timeout) <= 0) break;
+        }
+        if (response.size() >= 12 && response.compare(0, 5, "HTTP/") == 0) {
+            int status = std::atoi(response.c_str() + 9);
+            up = status >= 200 && status < 400;
+        }
+    }
+
+    closesocket(socket);
+    co_return up;
+}
+
+void Upstreams::configure(const std::map<std::string, UpstreamSettings>& upstreams, const std::vector<EventLoop*>& loops) {
+    pools.clear();
+    for (const auto& [name, settings] : upstreams) {
+        auto pool = std::make_unique<UpstreamPool>(name, settings, loops);
+        pool->startHealthChecks(*loops.front());
+        pools[name] = std::move(pool);
+    }
+}
+
+bool ReverseProxy::isHopByHop(const std::string& name) {
+    static const char* const names[] = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "Proxy-Authenticate", "Proxy-Authorization", "TE", "Trailer", "Transfer-Encoding", "Upgrade"
+    };
+    for (const char* hopByHop : names) {
+        if (_stricmp(name.c_str(), hopByHop) == 0) return true;
+    }
+    return false;
+}
+
+// Methods that can be sent twice without harm (RFC 9110 9.2.2).
+bool ReverseProxy::isIdempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "PUT" || method == "DELETE" || method == "TRACE";
+}
+
+Response ReverseProxy::failure(HttpStatus status) {
+    Response response;
+    response.setStatus(status);
+    return response;
+}
+
+std::string ReverseProxy::requestHead(const Request& request, const std::string& clientIp, bool tls, const std::string& host, const std::string& framing) {
+    std::string head;
+    head.reserve(512);
+    head += request.method + " " + (request.target.empty() ? std::string("/") : request.target) + " HTTP/1.1\r\n";
+
+    const std::vector<std::string> hopOptions = connectionOptions(request.headers);
+    std::string forwardedFor = clientIp;
+    for (const auto& [name, value] : request.headers) {
+        if (isHopByHop(name) || listed(hopOptions, name) || _stricmp(name.c_str(), "Content-Length") == 0 || _stricmp(name.c_str(), "X-Forwarded-Proto") == 0) continue;
+        // The body is sent right behind the head, so there is nothing to wait for.
+        if (_stricmp(name.c_str(), "Expect") == 0) continue;
+        if (_stricmp(name.c_str(), "X-Forwarded-For") == 0) {
+            forwardedFor = value + ", " + clientIp;
+            continue;
+        }
+        head += name + ": " + value + "\r\n";
+    }
+
+    const bool hasHost = std::any_of(request.headers.begin(), request.headers.end(), [](const auto& header) {
+        return _stricmp(header.first.c_str(), "Host") == 0;
+    });
+    if (!hasHost) head += "Host: " + host + "\r\n";
+    head += "X-Forwarded-For: " + forwardedFor + "\r\n";
+    head += tls ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n";
+    head += framing;
+    head += "Connection: keep-alive\r\n\r\n";
+    return head;
+}
+
+bool ReverseProxy::parseResponseHead(const std::string& text, ResponseHead& head) {
+    size_t lineEnd = text.find("\r\n");
+    head.statusLine = text.substr(0, lineEnd);
+    if (head.statusLine.size() < 12 || head.statusLine.compare(0, 5, "HTTP/") != 0) return false;
+
+    head.status = std::atoi(head.statusLine.c_str() + 9);
+    if (head.status < 100 || head.status > 999) return false;
+
+    // HTTP/1.0 upstreams close unless they say otherwise.
+    bool http10 = head.statusLine.compare(0, 8, "HTTP/1.0") == 0;
+    bool keepAlive = false;
+
+    size_t start = lineEnd + 2;
+    while (start < text.size()) {
+        size_t end = text.find("\r\n", start);
+        if (end == std::string::npos) end = text.size();
+
+        std::string line = text.substr(start, end - start);
+        start = end + 2;
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0) continue;
+
+        std::string name = line.substr(0, colon);
+        std::string value = trim(line.substr(colon + 1));
+
+        if (_stricmp(name.c_str(), "Content-Length") == 0) {
+            char* parsed = nullptr;
+            head.contentLength = std::strtoull(value.c_str(), &parsed, 10);
+            if (value.empty() || *parsed != '\0') return false;
+            head.hasLength = true;
+        } else if (_stricmp(name.c_str(), "Transfer-Encoding") == 0) {
+            head.chunked = containsToken(value, "chunked");
+        } else if (_stricmp(name.c_str(), "Connection") == 0) {
+            head.close = head.close || containsToken(value, "close");
+            keepAlive = containsToken(value, "keep-alive");
+        }
+
+        head.headers.emplace_back(std::move(name), std::move(value));
+    }
+
+    if (http10 && !keepAlive) head.close = true;
+    return true;
+}
+
+// 1 once a final response head is in buffer; 0 if the upstream closed or
+// reset the connection first; -1 on a timeout or a malformed response.
+Task<int> ReverseProxy::readResponseHead(EventLoop& loop, SOCKET socket, std::string& buffer, size_t& headEnd, ResponseHead& head, std::chrono::milliseconds timeout) {
+    static constexpr size_t MAX_HEAD = 64 * 1024;
+
+    while (true) {
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos) {
+            if (buffer.size() > MAX_HEAD) co_return -1;
+            int bytesRead = co_await loop.receive(socket, buffer, timeout);
+            if (bytesRead < 0 && closedByPeer(WSAGetLastError())) co_return 0;
+            if (bytesRead <= 0) co_return bytesRead;
+        }
+
+        head = ResponseHead();
+        if (!parseResponseHead(buffer.substr(0, end + 2), head)) co_return -1;
+
+        // Interim responses (100 Continue, 103 Early Hints) are dropped; no
+        // upgrade was offered, so 101 is an error.
+        if (head.status == 101) co_return -1;
+        if (head.status < 200) {
+            buffer.erase(0, end + 4);
+            continue;
+        }
+
+        headEnd = end + 4;
+        co_return 1;
+    }
+}
+
+Task<bool> ReverseProxy::relay(Connection& client, const std::string& upstream, Request& request, std::string& input, Options options) {
+    EventLoop& loop = client.loop;
+    Deadline& deadline = client.deadline;
+
+    UpstreamPool* pool = Upstreams::getInstance().find(upstream);
+    if (pool == nullptr) {
+        std::cout << "[!] [Proxy] Unknown upstream '" << upstream << "'." << std::endl;
+        deadline.arm(options.writeTimeout);
+        co_await client.send(errorHead(HttpStatus::BadGateway), std::string());
+        co_return false;
+    }
+    const std::chrono::milliseconds readTimeout(pool->getSettings().readTimeout);
+
+    // Request body framing. Chunked bodies are passed on chunked, as received.
+    auto transferEncoding = request.headers.find("Transfer-Encoding");
+    const bool chunked = transferEncoding != request.headers.end() && containsToken(transferEncoding->second, "chunked");
+    const uint64_t contentLength = request.contentLength > 0 ? static_cast<uint64_t>(request.contentLength) : 0;
+
+    std::string framing;
+    if (chunked) {
+        framing = "Transfer-Encoding: chunked\r\n";
+    } else if (contentLength > 0 || request.headers.count("Content-Length")) {
+        framing = "Content-Length: " + std::to_string(contentLength) + "\r\n";
+    }
+
+    ChunkedScanner requestChunks;
+    uint64_t sent = chunked ? requestChunks.scan(input.data(), input.size()) : std::min<uint64_t>(input.size(), contentLength);
+    bool requestComplete = chunked ? requestChunks.done() : sent == contentLength;
+    if (requestChunks.failed()) {
+        deadline.arm(options.writeTimeout);
+        co_await client.send(errorHead(HttpStatus::BadRequest), std::string());
+        co_return false;
+    }
+
+    const std::string firstPart = input.substr(0, static_cast<size_t>(sent));
+    input.erase(0, static_cast<size_t>(sent));
+
+    UpstreamPool::Lease lease;
+    ResponseHead response;
+    std::string buffer;
+    size_t headEnd = 0;
+
+    // A pooled connection the upstream closed just as it was picked fails on
+    // send, or closes before any response arrives; an idempotent request whose
+    // body was sent whole goes once more on a fresh connection. A timeout is
+    // never retried: the upstream may be working on the request.
+    for (int attempt = 0; ; ++attempt) {
+        lease = co_await pool->acquire(loop);
+        if (!lease) {
+            deadline.arm(options.writeTimeout);
+            co_await client.send(errorHead(HttpStatus::BadGateway), std::string());
+            co_return false;
+        }
+
+        const std::string head = requestHead(request, client.ip, client.tls != nullptr, lease.server->name, framing);
+        bool upstreamOk = co_await loop.sendAll(lease.socket, head, firstPart, options.writeTimeout);
+        bool dropped = !upstreamOk && closedByPeer(WSAGetLastError());
+
+        // The rest of the body goes on piece by piece as the client sends it.
+        std::string chunk;
+        while (upstreamOk && !requestComplete) {
+            deadline.arm(options.bodyTimeout);
+            chunk.clear();
+            if (co_await client.receive(chunk) <= 0) {
+                deadline.disarm();
+                pool->release(loop, lease, false);
+                co_return false;
+            }
+
+            size_t take = chunked ? requestChunks.scan(chunk.data(), chunk.size()) : static_cast<size_t>(std::min<uint64_t>(chunk.size(), contentLength - sent));
+            if (requestChunks.failed()) {
+                pool->release(loop, lease, false);
+                deadline.arm(options.writeTimeout);
+                co_await client.send(errorHead(HttpStatus::BadRequest), std::string());
+                co_return false;
+            }
+
+            sent += take;
+            requestComplete = chunked ? requestChunks.done() : sent == contentLength;
+            if (take < chunk.size()) {
+                input.assign(chunk, take, std::string::npos);
+                chunk.resize(take);
+            }
+            upstreamOk = co_await loop.sendAll(lease.socket, chunk, std::string(), options.writeTimeout);
+        }
+        deadline.disarm();
+
+        int result = upstreamOk ? co_await readResponseHead(loop, lease.socket, buffer, headEnd, response, readTimeout) : -1;
+        if (result > 0) break;
+
+        bool retry = attempt == 0 && lease.reused && isIdempotent(request.method) && (dropped || result == 0) &&
+            buffer.empty() && firstPart.size() == sent;
+        std::cout << "[!] [Proxy] " << upstream << ": " << lease.server->name << (result == 0 ? " closed the connection" : " failed") << " before responding." << std::endl;
+        pool->release(loop, lease, false);
+        if (!retry) {
+            deadline.arm(options.writeTimeout);
+            co_await client.send(errorHead(HttpStatus::BadGateway), std::string());
+            co_return false;
+        }
+    }
+
+    // Response body framing (RFC 9112 6.3).
+    BodyFraming::Kind kind = BodyFraming::Kind::Close;
+    if (request.method == "HEAD" || response.status == 204 || response.status == 304) kind = BodyFraming::Kind::None;
+    else if (response.chunked) kind = BodyFraming::Kind::Chunked;
+    else if (response.hasLength) kind = BodyFraming::Kind::Length;
+    BodyFraming body(kind, response.contentLength);
+
+    // A close-delimited body can only be passed on close-delimited.
+    const bool keepAlive = options.keepAlive && !body.untilClose();
+
+    // A chunked response has no length to compress up front, so it is
+    // compressed piece by piece as it streams through, into new chunks.
+    std::shared_ptr<const Settings> settings = Config::current();
+    const Settings& config = *settings;
+    std::string contentType;
+    bool encoded = false;
+    std::string vary;
+    for (const auto& [name, value] : response.headers) {
+        if (_stricmp(name.c_str(), "Content-Type") == 0) contentType = value;
+        else if (_stricmp(name.c_str(), "Content-Encoding") == 0) encoded = true;
+        else if (_stricmp(name.c_str(), "Vary") == 0) vary = value;
+    }
+    ContentEncoding encoding = ContentEncoding::Identity;
+    if (kind == BodyFraming::Kind::Chunked && config.compressionEnabled && !encoded && !request.acceptEncoding.empty() &&
+        isCompressibleType(contentType)) {
+        encoding = negotiateEncoding(request.acceptEncoding);
+    }
+    CompressionBudget budget(encoding == ContentEncoding::Identity ? 0 : config.compressionWorkers);
+    std::unique_ptr<Compressor> compressor;
+    if (budget) {
+        compressor = std::make_unique<Compressor>(encoding);
+        if (!compressor->begin(config.compressionLevel)) compressor.reset();
+    }
+
+    const std::vector<std::string> hopOptions = connectionOptions(response.headers);
+    std::string head = response.statusLine + "\r\n";
+    for (const auto& [name, value] : response.headers) {
+        if (isHopByHop(name) || listed(hopOptions, name)) continue;
+        if (response.chunked && _stricmp(name.c_str(), "Content-Length") == 0) continue;
+        if (compressor && _stricmp(name.c_str(), "Vary") == 0) continue;
+        head += name + ": " + value + "\r\n";
+    }
+    if (compressor) {
+        head += std::string("Content-Encoding: ") + contentEncodingName(encoding) + "\r\n";
+        head += "Vary: " + (vary.empty() ? std::string("Accept-Encoding") : vary + ", Accept-Encoding") + "\r\n";
+    }
+    if (response.chunked) head += "Transfer-Encoding: chunked\r\n";
+    head += keepAlive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+    // Takes the body out of data; when compressing, data is replaced by the
+    // compressed piece as chunks. Bytes past the end of the body would be a
+    // response nobody asked for.
+    bool reusable = !response.close;
+    auto takeBody = [&](std::string& data) -> bool {
+        if (!compressor) {
+            size_t take = body.take(data.data(), data.size(), nullptr);
+            if (take < data.size()) {
+                reusable = false;
+                data.resize(take);
+            }
+            return true;
+        }
+
+        std::string plain;
+        if (body.take(data.data(), data.size(), &plain) < data.size()) reusable = false;
+
+        std::string compressed;
+        const bool last = body.complete() && !body.failed();
+        if (!compressor->update(plain.data(), plain.size(), compressed, last)) return false;
+
+        data.clear();
+        if (!compressed.empty()) {
+            char size[24];
+            snprintf(size, sizeof(size), "%zx\r\n", compressed.size());
+            data += size;
+            data += compressed;
+            data += "\r\n";
+        }
+        if (last) data += "0\r\n\r\n";
+        return true;
+    };
+
+    std::string data = buffer.substr(headEnd);
+    bool bodyOk = takeBody(data);
+
+    deadline.arm(options.writeTimeout);
+    bool clientOk = co_await client.send(head, data);
+
+    // One piece in flight at a time: a slow client holds the upstream back
+    // instead of making the proxy buffer for it.
+    while (clientOk && bodyOk && !body.complete() && !body.failed()) {
+        data.clear();
+        int bytesRead = co_await loop.receive(lease.socket, data, readTimeout);
+        if (bytesRead <= 0) {
+            reusable = false;
+            if (bytesRead == 0 && body.untilClose()) {
+                deadline.disarm();
+                pool->release(loop, lease, false);
+                co_return false;
+            }
+            break;
+        }
+
+        bodyOk = takeBody(data);
+        if (!bodyOk || data.empty()) continue;
+
+        deadline.arm(options.writeTimeout);
+        clientOk = co_await client.send(data, std::string());
+    }
+    deadline.disarm();
+
+    // A response cut short cannot be repaired; closing tells the client so.
+    const bool complete = bodyOk && body.complete() && !body.failed();
+    pool->release(loop, lease, reusable && complete);
+    co_return clientOk && complete && keepAlive;
+}
+
+Task<Response> ReverseProxy::forward(const std::string& upstream, Request& request) {
+    EventLoop& loop = *EventLoop::current();
+
+    UpstreamPool* pool = Upstreams::getInstance().find(upstream);
+    if (pool == nullptr) {
+        std::cout << "[!] [Proxy] Unknown upstream '" << upstream << "'." << std::endl;
+        co_return failure(HttpStatus::BadGateway);
+    }
+    const std::chrono::milliseconds readTimeout(pool->getSettings().readTimeout);
+    const std::chrono::milliseconds writeTimeout(Config::current()->writeTimeout);
+
+    std::string framing;
+    if (!request.body.empty() || (request.method != "GET" && request.method != "HEAD")) {
+        framing = "Content-Length: " + std::to_string(request.body.size()) + "\r\n";
+    }
+
+    UpstreamPool::Lease lease;
+    ResponseHead response;
+    std::string buffer;
+    size_t headEnd = 0;
+
+    for (int attempt = 0; ; ++attempt) {
+        lease = co_await pool->acquire(loop);
+        if (!lease) co_return failure(HttpStatus::BadGateway);
+
+        const std::string head = requestHead(request, request.clientIp, request.secure, lease.server->name, framing);
+        bool upstreamOk = co_await loop.sendAll(lease.socket, head, request.body, writeTimeout);
+        bool dropped = !upstreamOk && closedByPeer(WSAGetLastError());
+        int result = upstreamOk ? co_await readResponseHead(loop, lease.socket, buffer, headEnd, response, readTimeout) : -1;
+        if (result > 0) break;
+
+        bool retry = attempt == 0 && lease.reused && isIdempotent(request.method) && (dropped || result == 0) && buffer.empty();
+        pool->release(loop, lease, false);
+        if (!retry) co_return failure(HttpStatus::BadGateway);
+    }
+
+    BodyFraming::Kind kind = BodyFraming::Kind::Close;
+    if (request.method == "HEAD" || response.status == 204 || response.status == 304) kind = BodyFraming::Kind::None;
+    else if (response.chunked) kind = BodyFraming::Kind::Chunked;
+    else if (response.hasLength) kind = BodyFraming::Kind::Length;
+    BodyFraming body(kind, response.contentLength);
+
+    bool reusable = !response.close;
+    std::string decoded;
+    std::string data = buffer.substr(headEnd);
+    if (body.take(data.data(), data.size(), &decoded) < data.size()) reusable = false;
+
+    while (!body.complete() && !body.failed()) {
+        data.clear();
+        int bytesRead = co_await loop.receive(lease.socket, data, readTimeout);
+        if (bytesRead <= 0) {
+            reusable = false;
+            if (bytesRead == 0 && body.untilClose()) break;
+            pool->release(loop, lease, false);
+            co_return failure(HttpStatus::BadGateway);
+        }
+        if (body.take(data.data(), data.size(), &decoded) < data.size()) reusable = false;
+    }
+
+    if (body.failed()) {
+        pool->release(loop, lease, false);
+        co_return failure(HttpStatus::BadGateway);
+    }
+    pool->release(loop, lease, reusable && body.complete());
+
+    const std::vector<std::string> hopOptions = connectionOptions(response.headers);
+    Response out;
+    out.setStatusCode(response.status);
+    for (const auto& [name, value] : response.headers) {
+        if (isHopByHop(name) || listed(hopOptions, name) || _stricmp(name.c_str(), "Content-Length") == 0) continue;
+        if (_stricmp(name.c_str(), "Content-Type") == 0) {
+            out.setContentType(value);
+        } else {
+            out.setHeader(name, value);
+        }
+    }
+    out.setBody(decoded);
+    co_return out;
+}
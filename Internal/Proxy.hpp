@@ -0,0 +1,260 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <MSWSock.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Config.hpp"
+#include "Connection.hpp"
+#include "EventLoop.hpp"
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Task.hpp"
+
+using namespace HTTP;
+
+// Finds the end of a chunked body (RFC 9112 7.1) without buffering it, so the
+// proxy can pass chunked messages through untouched. Optionally decodes the
+// chunk data as it goes.
+class ChunkedScanner {
+public:
+    // Scans up to size bytes and returns how many belong to the body: all of
+    // them, unless the body ends inside the buffer. Chunk data is appended to
+    // decoded when given.
+    size_t scan(const char* data, size_t size, std::string* decoded = nullptr) {
+        size_t i = 0;
+        while (i < size && state != State::Done && state != State::Error) {
+            char c = data[i];
+            switch (state) {
+            case State::Size:
+                if (std::isxdigit(static_cast<unsigned char>(c))) {
+                    if (remaining > (UINT64_MAX >> 4)) {
+                        state = State::Error;
+                        break;
+                    }
+                    remaining = remaining * 16 + static_cast<uint64_t>(std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : (std::tolower(c) - 'a' + 10));
+                    digits = true;
+                } else if (digits && (c == ';' || c == ' ' || c == '\t')) {
+                    state = State::Extension;
+                } else if (digits && c == '\r') {
+                    state = State::SizeLf;
+                } else if (digits && c == '\n') {
+                    endOfSize();
+                } else {
+                    state = State::Error;
+                }
+                ++i;
+                break;
+            case State::Extension:
+                if (c == '\n') endOfSize();
+                else if (c == '\r') state = State::SizeLf;
+                ++i;
+                break;
+            case State::SizeLf:
+                if (c == '\n') endOfSize();
+                else state = State::Error;
+                ++i;
+                break;
+            case State::Data: {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(remaining, size - i));
+                if (decoded) decoded->append(data + i, take);
+                remaining -= take;
+                i += take;
+                if (remaining == 0) state = State::DataCr;
+                break;
+            }
+            case State::DataCr:
+                state = c == '\r' ? State::DataLf : State::Error;
+                ++i;
+                break;
+            case State::DataLf:
+                state = c == '\n' ? State::Size : State::Error;
+                digits = false;
+                ++i;
+                break;
+            case State::Trailer:
+                // Trailer fields are passed through but not interpreted.
+                if (c == '\n') {
+                    if (lineLength == 0) state = State::Done;
+                    lineLength = 0;
+                } else if (c != '\r') {
+                    ++lineLength;
+                }
+                ++i;
+                break;
+            default:
+                break;
+            }
+        }
+        return i;
+    }
+
+    bool done() const {
+        return state == State::Done;
+    }
+
+    bool failed() const {
+        return state == State::Error;
+    }
+
+private:
+    enum class State { Size, Extension, SizeLf, Data, DataCr, DataLf, Trailer, Done, Error };
+
+    State state = State::Size;
+    uint64_t remaining = 0;
+    bool digits = false;
+    size_t lineLength = 0;
+
+    void endOfSize() {
+        state = remaining == 0 ? State::Trailer : State::Data;
+        lineLength = 0;
+    }
+};
+
+// The servers behind one named upstream, and the keep-alive connections to
+// them. Idle connections are kept per event loop: a socket is tied to the
+// completion port it was first attached to, and each list is only touched
+// from its own loop thread, so leasing one takes no lock.
+class UpstreamPool {
+public:
+    struct Server {
+        std::string name;
+        sockaddr_in address{};
+        std::atomic<bool> healthy{ true };
+        std::atomic<size_t> active{ 0 };
+        // Set by a failed connect; the server sits out until then.
+        std::atomic<int64_t> retryAt{ 0 };
+    };
+
+    // A connection checked out of the pool. Return it with release().
+    struct Lease {
+        SOCKET socket = INVALID_SOCKET;
+        Server* server = nullptr;
+        bool reused = false;
+
+        explicit operator bool() const {
+            return socket != INVALID_SOCKET;
+        }
+    };
+
+    UpstreamPool(std::string name, const UpstreamSettings& settings, const std::vector<EventLoop*>& loops);
+    ~UpstreamPool();
+
+    UpstreamPool(const UpstreamPool&) = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    const std::string& getName() const {
+        return name;
+    }
+
+    const UpstreamSettings& getSettings() const {
+        return settings;
+    }
+
+    // Loop thread only. Picks a server and hands out an idle connection to it,
+    // or connects a new one. An empty lease means no server could be reached.
+    Task<Lease> acquire(EventLoop& loop);
+
+    // Loop thread only. reusable: the last response was read to its end and
+    // the upstream did not ask to close.
+    void release(EventLoop& loop, Lease& lease, bool reusable);
+
+    // Polls healthPath on every server from loop until the pool is destroyed.
+    void startHealthChecks(EventLoop& loop);
+
+private:
+    struct Idle {
+        SOCKET socket;
+        Server* server;
+    };
+
+    std::string name;
+    UpstreamSettings settings;
+    std::vector<std::unique_ptr<Server>> servers;
+    std::atomic<size_t> nextServer{ 0 };
+    std::unordered_map<EventLoop*, std::vector<Idle>> idle;
+    std::shared_ptr<std::atomic<bool>> running = std::make_shared<std::atomic<bool>>(true);
+    LPFN_CONNECTEX connectEx = nullptr;
+
+    Server* pick();
+    Task<SOCKET> connect(EventLoop& loop, Server& server);
+    void markDown(Server& server);
+
+    Task<void> healthLoop(EventLoop& loop, std::shared_ptr<std::atomic<bool>> running);
+    Task<bool> probe(EventLoop& loop, Server& server);
+
+    static int64_t nowMs();
+    static bool stillOpen(SOCKET socket);
+};
+
+// Named upstream pools, built from "upstreams" in the settings once the event
+// loops exist.
+class Upstreams {
+public:
+    static Upstreams& getInstance() {
+        static Upstreams instance;
+        return instance;
+    }
+
+    void configure(const std::map<std::string, UpstreamSettings>& upstreams, const std::vector<EventLoop*>& loops);
+
+    UpstreamPool* find(const std::string& name) {
+        auto it = pools.find(name);
+        return it != pools.end() ? it->second.get() : nullptr;
+    }
+
+private:
+    Upstreams() = default;
+
+    std::map<std::string, std::unique_ptr<UpstreamPool>> pools;
+};
+
+// Forwards requests to an upstream pool. Over HTTP/1.1 the request and
+// response bodies stream through in whatever pieces the sockets deliver, so
+// neither is ever held whole; HTTP/2 streams are answered from a buffered
+// response instead.
+class ReverseProxy {
+public:
+    struct Options {
+        std::chrono::milliseconds bodyTimeout{ 10000 };
+        std::chrono::milliseconds writeTimeout{ 30000 };
+        bool keepAlive = true;
+    };
+
+    // Relays request, whose head has been parsed, to the named upstream and
+    // the response back to client. input holds what the client sent after the request
+    // head; on return it holds whatever followed the request body. Returns
+    // whether the client connection can carry another request.
+    static Task<bool> relay(Connection& client, const std::string& upstream, Request& request, std::string& input, Options options);
+
+    // Sends a request with its whole body to the named upstream and returns
+    // the decoded response.
+    static Task<Response> forward(const std::string& upstream, Request& request);
+
+private:
+    struct ResponseHead {
+        int status = 0;
+        std::string statusLine;
+        std::vector<std::pair<std::string, std::string>> headers;
+        bool chunked = false;
+        bool hasLength = false;
+        uint64_t contentLength = 0;
+        bool close = false;
+    };
+
+    static std::string requestHead(const Request& request, const std::string& clientIp, bool tls, const std::string& host, const std::string& framing);
+    static bool parseResponseHead(const std::string& text, ResponseHead& head);
+    static Task<int> readResponseHead(EventLoop& loop, SOCKET socket, std::string& buffer, size_t& headEnd, ResponseHead& head, std::chrono::milliseconds timeout);
+    static bool isHopByHop(const std::string& name);
+    static bool isIdempotent(const std::string& method);
+    static Response failure(HttpStatus status);
+};
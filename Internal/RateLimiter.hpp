@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "Request.hpp"
+#include "Response.hpp"
+#include "Task.hpp"
+#include "Middleware.hpp"
+#include "Utils.hpp"
+
+using namespace HTTP;
+
+// Token buckets for any number of keys in fixed memory. The table is split
+// into 4-way sets of one cache line each; a key hashes to one set and lives in
+// one of its ways, so a check costs a few atomic loads and one CAS with no
+// locks. A bucket is a single 64-bit word (last refill time and remaining
+// tokens) updated with compare-and-swap. When a set is full the way touched
+// least recently is taken over (approximate LRU), which only forgets idle
+// clients, and only ever in their favour. Taking a way over claims its bucket
+// first, then publishes the new key and a full bucket, so no request is ever
+// charged against another key's tokens.
+class RateLimiter {
+public:
+    using KeyFunction = std::function<std::string(const Request&)>;
+
+    struct Options {
+        double rate = 10.0;         // tokens per second
+        double burst = 20.0;        // bucket size
+        size_t slots = 1 << 16;     // rounded up to a multiple of WAYS
+    };
+
+    struct Decision {
+        bool allowed;
+        std::chrono::milliseconds retryAfter;
+    };
+
+    static KeyFunction byClientIp() {
+        return [](const Request& req) { return req.clientIp; };
+    }
+
+    static KeyFunction byHeader(std::string name) {
+        return [name = std::move(name)](const Request& req) {
+            auto it = req.headers.find(name);
+            return it != req.headers.end() ? it->second : std::string();
+        };
+    }
+
+    static KeyFunction byRoute() {
+        return [](const Request& req) { return req.method + " " + Utils::normalizePath(req.path); };
+    }
+
+    RateLimiter() : RateLimiter(Options()) {
+    }
+
+    explicit RateLimiter(Options options)
+        : rate(std::max(options.rate, 0.001)),
+          burst(static_cast<uint32_t>(std::clamp(options.burst, 1.0, MAX_TOKENS / 1000.0 - 1) * 1000)),
+          setCount(std::max<size_t>((options.slots + WAYS - 1) / WAYS, 1)),
+          sets(new Set[setCount]),
+          origin(std::chrono::steady_clock::now()) {
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Takes one token from key's bucket.
+    Decision take(const std::string& key) {
+        uint64_t hash = std::hash<std::string>{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        if (hash == EMPTY) hash = 1;
+
+        const uint32_t now = elapsedMs();
+        Set& set = sets[hash % setCount];
+
+        while (true) {
+            Slot& slot = find(set, hash, now);
+
+            // The key is checked again after each read of the bucket: a way
+            // taken over since find() shows either CLAIMED or the new key.
+            uint64_t current = slot.state.load(std::memory_order_acquire);
+            while (current != CLAIMED && slot.key.load(std::memory_order_relaxed) == hash) {
+                uint32_t last = static_cast<uint32_t>(current >> 32);
+                uint32_t tokens = static_cast<uint32_t>(current);
+
+                // Tokens are kept in thousandths: `rate` per second is `rate` per ms.
+                // Another thread may have stamped a later time than our `now`.
+                int32_t delta = static_cast<int32_t>(now - last);
+                uint32_t since = delta > 0 ? static_cast<uint32_t>(delta) : 0;
+                uint64_t added = static_cast<uint64_t>(since * rate);
+                uint64_t available = std::min<uint64_t>(tokens + added, burst);
+                // Sub-thousandth refills would be lost; keep the old time until they add up.
+                uint32_t stamp = added > 0 ? now : last;
+
+                if (available < 1000) {
+                    auto wait = static_cast<long long>((1000 - available) / rate) + 1;
+                    return { false, std::chrono::milliseconds(wait) };
+                }
+
+                uint64_t next = (static_cast<uint64_t>(stamp) << 32) | (available - 1000);
+                if (slot.state.compare_exchange_weak(current, next, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                    return { true, std::chrono::milliseconds(0) };
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t WAYS = 4;
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr double MAX_TOKENS = 4294967295.0;
+    // A way's bucket while it is handed to a new key. Never a real bucket:
+    // tokens stay below the burst limit, which is below 2^32 - 1.
+    static constexpr uint64_t CLAIMED = UINT64_MAX;
+
+    struct Slot {
+        std::atomic<uint64_t> key{ EMPTY };
+        std::atomic<uint64_t> state{ 0 };
+    };
+
+    struct alignas(64) Set {
+        Slot ways[WAYS];
+    };
+
+    const double rate;
+    const uint32_t burst;
+    const size_t setCount;
+    std::unique_ptr<Set[]> sets;
+    const std::chrono::steady_clock::time_point origin;
+
+    uint32_t elapsedMs() const {
+        // Wraps after ~49 days; bucket arithmetic is modulo 2^32 as well.
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - origin);
+        return static_cast<uint32_t>(elapsed.count());
+    }
+
+    Slot& find(Set& set, uint64_t hash, uint32_t now) {
+        while (true) {
+            Slot* victim = nullptr;
+            uint32_t oldest = 0;
+            uint64_t victimKey = EMPTY;
+            uint64_t victimState = 0;
+
+            for (Slot& slot : set.ways) {
+                uint64_t key = slot.key.load(std::memory_order_acquire);
+                if (key == hash) return slot;
+
+                // Another thread is already taking this way over.
+                uint64_t state = slot.state.load(std::memory_order_relaxed);
+                if (state == CLAIMED) continue;
+
+                // Empty ways count as the oldest possible.
+                int32_t delta = static_cast<int32_t>(now - static_cast<uint32_t>(state >> 32));
+                uint32_t age = key == EMPTY ? UINT32_MAX : static_cast<uint32_t>(std::max(delta, 0));
+                if (victim == nullptr || age > oldest) {
+                    victim = &slot;
+                    oldest = age;
+                    victimKey = key;
+                    victimState = state;
+                }
+            }
+            if (victim == nullptr) continue;
+
+            // Claiming the bucket fails any CAS still in flight for the old key.
+            // The new key is stored before the full bucket is released, so a
+            // thread that reads the bucket also sees whose it is. A racing
+            // thread may claim the same way; whoever loses looks again.
+            if (!victim->state.compare_exchange_strong(victimState, CLAIMED, std::memory_order_acquire)) continue;
+            if (victim->key.load(std::memory_order_relaxed) != victimKey) {
+                victim->state.store(victimState, std::memory_order_release);
+                continue;
+            }
+
+            victim->key.store(hash, std::memory_order_relaxed);
+            victim->state.store((static_cast<uint64_t>(now) << 32) | burst, std::memory_order_release);
+            return *victim;
+        }
+    }
+};
+
+namespace Middleware {
+    // Answers 429 Too Many Requests once key's bucket is empty; requests without
+    // the key (e.g. no API key header) share one bucket. Copies share one
+    // limiter, so the same layer can guard several routes together.
+    class RateLimit {
+    private:
+        std::shared_ptr<RateLimiter> limiter;
+        RateLimiter::KeyFunction key;
+
+    public:
+        RateLimit(RateLimiter::Options options, RateLimiter::KeyFunction key = RateLimiter::byClientIp())
+            : limiter(std::make_shared<RateLimiter>(options)), key(std::move(key)) {
+        }
+
+        // Not a coroutine: an allowed request goes straight on to next.
+        template <typename Next>
+        Task<Response> operator()(Request& req, Next& next) {
+            RateLimiter::Decision decision = limiter->take(key(req));
+            if (decision.allowed) return next(req);
+
+            long long seconds = (decision.retryAfter.count() + 999) / 1000;
+            Response response;
+            response.setStatus(HttpStatus::TooManyRequests).setHeader("Retry-After", std::to_string(seconds));
+            return Detail::ready(std::move(response));
+        }
+    };
+}
@@ -1,12 +1,29 @@
 #pragma once
 
+#include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 #include <nlohmann/json.hpp>
 
+#include "Task.hpp"
+
 using json = nlohmann::json;
 
 namespace HTTP {
+	// A multipart file part, already on disk. The file is removed once the
+	// response has been produced; move it elsewhere to keep it.
+	struct UploadedFile {
+		std::string field;
+		std::string filename;
+		std::string contentType;
+		std::filesystem::path path;
+		uint64_t size = 0;
+	};
+
 	class Request {
 	private:
 	public:
@@ -14,21 +31,36 @@ namespace HTTP {
 
 		std::string method;
 		std::string path;
+		std::string target;
 
 		std::unordered_map<std::string, std::string> headers;
 		std::unordered_map<std::string, std::string> cookies;
 
 		std::string protocol;
 		std::string userAgent;
+		std::string acceptEncoding;
 		std::string clientIp;
+		bool secure = false;	// arrived over TLS
 
 		std::unordered_map<std::string, std::string> query;
 		std::unordered_map<std::string, std::string> form;
 		std::unordered_map<std::string, std::string> params;
+		std::vector<UploadedFile> files;
 
 		std::string body;
 		json json;
 
+		// Set while a body that streams in (multipart over HTTP/1.1) is still
+		// unread. Reads it into form and files once routing and middleware
+		// have let the request through; false if it is malformed or too large.
+		std::function<Task<bool>()> readBody;
+
+		// Set by an upload route (Router::addUploadRoute): gets each multipart
+		// part as it arrives instead of form and files. part has no path, and
+		// its size counts the bytes passed before data; end is true in one
+		// last call once the part is complete. False rejects the upload.
+		std::function<Task<bool>(const UploadedFile& part, std::string_view data, bool end)> onPart;
+
 		std::string contentType;
 		int contentLength;
 	};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "Request.hpp"
+#include "Utils.hpp"
+
+using namespace Utils;
+
+// Request field parsing shared by the HTTP/1.1 and HTTP/2 front ends.
+namespace HTTP {
+    // Header names are case-insensitive. The ones the server looks up are
+    // stored under one spelling, so lookups need not care how the client wrote them.
+    inline std::string wellKnownName(const std::string& name)
+    {
+        static const char* const names[] = {
+            "Accept-Encoding", "Access-Control-Request-Method", "Connection", "Content-Length", "Content-Type", "Cookie",
+            "Expect", "HTTP2-Settings", "Host", "Sec-WebSocket-Key", "Sec-WebSocket-Version", "Transfer-Encoding",
+            "Upgrade", "User-Agent", "X-Forwarded-For", "X-Forwarded-Proto", "X-Request-Id"
+        };
+        for (const char* known : names) {
+            if (_stricmp(name.c_str(), known) == 0) return known;
+        }
+        return name;
+    }
+
+    // Throws std::invalid_argument for a header that makes the body's framing
+    // ambiguous: a repeated or non-numeric Content-Length.
+    inline void applyHeader(Request& req, const std::string& name, const std::string& value)
+    {
+        const std::string key = wellKnownName(name);
+
+        if (key == "Content-Length") {
+            if (req.headers.count(key)) throw std::invalid_argument("Duplicate Content-Length");
+            if (value.empty() || value.size() > 18 || value.find_first_not_of("0123456789") != std::string::npos) throw std::invalid_argument("Invalid Content-Length");
+            // Anything past INT_MAX is over every limit anyway.
+            req.contentLength = static_cast<int>(std::min<long long>(std::stoll(value), INT_MAX));
+        }
+
+        // Repeated Transfer-Encoding fields form one list.
+        if (key == "Transfer-Encoding" && req.headers.count(key)) {
+            req.headers[key] += ", " + value;
+            return;
+        }
+
+        req.headers[key] = value;
+
+        if (key == "Content-Type")
+            req.contentType = value;
+
+        if (key == "User-Agent")
+            req.userAgent = value;
+
+        if (key == "Accept-Encoding")
+            req.acceptEncoding = value;
+
+        if (key == "Cookie") {
+            std::stringstream cs(value);
+            std::string kv;
+            while (std::getline(cs, kv, ';')) {
+                size_t eq = kv.find('=');
+                if (eq == std::string::npos) continue;
+
+                std::string ckey = kv.substr(0, eq);
+                std::string cval = kv.substr(eq + 1);
+
+                ckey.erase(0, ckey.find_first_not_of(" \r\t"));
+                ckey.erase(ckey.find_last_not_of(" \r\t") + 1);
+                cval.erase(0, cval.find_first_not_of(" \r\t"));
+                cval.erase(cval.find_last_not_of(" \r\t") + 1);
+
+                req.cookies[urlDecode(ckey)] = urlDecode(cval);
+            }
+        }
+    }
+
+    // Splits the request target into path and query parameters.
+    inline void applyTarget(Request& req, const std::string& target)
+    {
+        req.target = target;
+        req.path = target;
+
+        auto pos = req.path.find('?');
+        if (pos != std::string::npos) {
+            std::string qs = req.path.substr(pos + 1);
+            req.path = req.path.substr(0, pos);
+
+            std::stringstream ss(qs);
+            std::string kv;
+            while (std::getline(ss, kv, '&')) {
+                size_t eq = kv.find('=');
+                if (eq == std::string::npos) continue;
+
+                auto key = urlDecode(kv.substr(0, eq));
+                auto value = urlDecode(kv.substr(eq + 1));
+                req.query[key] = value;
+            }
+        }
+
+        req.path = urlDecode(req.path);
+    }
+
+    // Throws std::invalid_argument when the body cannot be framed unambiguously
+    // (RFC 9112 6.3): both Transfer-Encoding and Content-Length, or a bad
+    // Content-Length. Such a request must be rejected and the connection closed.
+    inline Request parseRequest(std::istringstream& stream)
+    {
+        Request req;
+
+        std::string requestLine;
+        std::getline(stream, requestLine);
+        std::istringstream rl(requestLine);
+        std::string target;
+        rl >> req.method;
+        rl >> target;
+        rl >> req.protocol;
+
+        std::string headerLine;
+        while (std::getline(stream, headerLine))
+        {
+            if (headerLine == "\r" || headerLine.empty())
+                break;
+
+            size_t colonPos = headerLine.find(':');
+            if (colonPos == std::string::npos)
+                continue;
+
+            std::string key = headerLine.substr(0, colonPos);
+            std::string value = headerLine.substr(colonPos + 1);
+
+            // trim key
+            key.erase(0, key.find_first_not_of(" \r\t"));
+            key.erase(key.find_last_not_of(" \r\t") + 1);
+
+            // trim value
+            value.erase(0, value.find_first_not_of(" \r\t"));
+            value.erase(value.find_last_not_of(" \r\t") + 1);
+
+            applyHeader(req, key, value);
+        }
+
+        if (req.headers.count("Transfer-Encoding") && req.headers.count("Content-Length"))
+            throw std::invalid_argument("Both Transfer-Encoding and Content-Length");
+
+        applyTarget(req, target);
+
+        return req;
+    }
+}
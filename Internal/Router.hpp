@@ -11,6 +11,13 @@
 #include "Request.hpp"
 #include "Response.hpp"
 #include "Utils.hpp"
+#include "Config.hpp"
+#include "Task.hpp"
+#include "EventLoop.hpp"
+#include "WebSocket.hpp"
+#include "Middleware.hpp"
+#include "Multipart.hpp"
+#include "Proxy.hpp"
 
 using namespace HTTP;
 using namespace Utils;
@@ -18,19 +25,23 @@ using json = nlohmann::json;
 
 class Router {
 private:
-    static constexpr size_t MAX_REQUEST_SIZE = 16 * 1024;
     inline static std::unordered_set<std::string> validMethods = {
         "GET", "POST", "PUT", "DELETE", "PATCH", "OPTIONS", "HEAD"
     };
 
-    Router() = default;
+    Router() {
+        endpoint = [this](Request& req) {
+            return dispatch(req);
+        };
+    }
 
     Router(const Router&) = delete;
     Router& operator=(const Router&) = delete;
-
-    std::filesystem::path publicPath;
 public:
     using Handler = std::function<Response(Request&)>;
+    using AsyncHandler = std::function<Task<Response>(Request&)>;
+    using WebSocketHandler = std::function<Task<void>(WebSocket&, Request&)>;
+    using PartHandler = std::function<Task<bool>(Request&, const UploadedFile& part, std::string_view data, bool end)>;
 
     static Router& getInstance() {
         static Router instance;
@@ -38,11 +49,7 @@ public:
     }
 
     size_t getMaxRequestSize() {
-        return MAX_REQUEST_SIZE;
-    }
-
-    void setPublicPath(const std::filesystem::path& path) {
-        publicPath = path;
+        return Config::current()->maxRequestSize;
     }
 
     void addRoute(const std::string& method, const std::string& path, Handler handler) {
@@ -53,17 +60,191 @@ public:
         }
 
         std::cout << "[+] [Router] Route created: " << normalizedMethod << " " << path << std::endl;
-        routes.push_back({ normalizedMethod, splitPath(path), handler });
+        routes.push_back({ normalizedMethod, splitPath(path), handler, nullptr, nullptr });
+    }
+
+    // Coroutine handlers run on the connection's event loop and may co_await
+    // socket, timer and file operations without holding up the loop thread.
+    void addAsyncRoute(const std::string& method, const std::string& path, AsyncHandler handler) {
+        std::string normalizedMethod = normalizeMethod(method);
+        if (normalizedMethod.empty()) {
+            std::cout << "[!] [Router] Unsupported HTTP method '" << method << "' for route '" << path << "' - route definition not applied." << std::endl;
+            return;
+        }
+
+        std::cout << "[+] [Router] Async route created: " << normalizedMethod << " " << path << std::endl;
+        routes.push_back({ normalizedMethod, splitPath(path), nullptr, handler, nullptr });
+    }
+
+    // Multipart upload route that takes the parts itself, as they arrive,
+    // rather than from form and files: onPart (see Request::onPart) runs for
+    // every piece of every part, then handler once the body is complete.
+    void addUploadRoute(const std::string& method, const std::string& path, PartHandler onPart, AsyncHandler handler) {
+        std::string normalizedMethod = normalizeMethod(method);
+        if (normalizedMethod.empty()) {
+            std::cout << "[!] [Router] Unsupported HTTP method '" << method << "' for route '" << path << "' - route definition not applied." << std::endl;
+            return;
+        }
+
+        std::cout << "[+] [Router] Upload route created: " << normalizedMethod << " " << path << std::endl;
+        routes.push_back({ normalizedMethod, splitPath(path), nullptr, handler, nullptr, false, onPart });
+    }
+
+    // Route with its own middleware, composed at compile time:
+    //     router.addRoute("POST", "/json", handler, Middleware::RateLimit({ 5.0, 10.0, 1 << 16 }));
+    // Layers run in the order given, outermost first, and before the body is
+    // parsed, so one that answers early spares the parse. The handler may be
+    // synchronous or a coroutine.
+    template <typename RouteHandler, typename Layer, typename... Layers>
+    void addRoute(const std::string& method, const std::string& path, RouteHandler handler, Layer layer, Layers... layers) {
+        std::string normalizedMethod = normalizeMethod(method);
+        if (normalizedMethod.empty()) {
+            std::cout << "[!] [Router] Unsupported HTTP method '" << method << "' for route '" << path << "' - route definition not applied." << std::endl;
+            return;
+        }
+
+        std::cout << "[+] [Router] Route created: " << normalizedMethod << " " << path << " (+" << (1 + sizeof...(Layers)) << " middleware)" << std::endl;
+        auto parsed = [handler = std::move(handler)](Request& req) mutable {
+            return parseBodyThen(handler, req);
+        };
+        routes.push_back({ normalizedMethod, splitPath(path), nullptr, Middleware::chain(std::move(parsed), std::move(layer), std::move(layers)...), nullptr, true });
+    }
+
+    // Global middleware, run for every request (including ones that match no
+    // route) in the order added. Register before the server starts.
+    template <typename Layer>
+    void use(Layer layer) {
+        middleware.push_back([layer = std::move(layer)](Request& req, Middleware::Next& next) mutable {
+            return layer(req, next);
+        });
+    }
+
+    // Upgrade-only routes: the handler owns the connection once the handshake
+    // has been answered, and returns when it is done with the socket.
+    void addWebSocketRoute(const std::string& path, WebSocketHandler handler) {
+        std::cout << "[+] [Router] WebSocket route created: " << path << std::endl;
+        webSocketRoutes.push_back({ "GET", splitPath(path), nullptr, nullptr, handler });
+    }
+
+    // Upgrade route with its own middleware, run after the global layers and
+    // before the handshake. A layer that answers refuses the upgrade.
+    template <typename Layer, typename... Layers>
+    void addWebSocketRoute(const std::string& path, WebSocketHandler handler, Layer layer, Layers... layers) {
+        std::cout << "[+] [Router] WebSocket route created: " << path << " (+" << (1 + sizeof...(Layers)) << " middleware)" << std::endl;
+        webSocketRoutes.push_back({ "GET", splitPath(path), nullptr, Middleware::chain(switching, std::move(layer), std::move(layers)...), handler });
+    }
+
+    // Runs the middleware in front of a WebSocket handshake for handler, as
+    // returned by matchWebSocket (nullptr: no route, answered 404). 101
+    // Switching Protocols means go ahead; anything else is the answer instead.
+    Task<Response> admitWebSocket(Request& req, const WebSocketHandler* handler) {
+        Middleware::Endpoint handshake = [handler](Request& req) {
+            if (handler == nullptr) return Middleware::Detail::ready(Response().setStatus(HttpStatus::NotFound));
+            return Middleware::Detail::ready(switching(req));
+        };
+        for (auto& r : webSocketRoutes) {
+            if (&r.webSocketHandler == handler && r.asyncHandler) handshake = r.asyncHandler;
+        }
+
+        Middleware::Next next(middleware, handshake);
+        co_return co_await next(req);
+    }
+
+    const WebSocketHandler* matchWebSocket(Request& req) {
+        std::string normalizedPath = normalizePath(req.path);
+        if (normalizedPath.empty()) return nullptr;
+
+        for (auto& r : webSocketRoutes) {
+            std::unordered_map<std::string, std::string> params;
+            if (matchRoute(r.parts, splitPath(normalizedPath), params)) {
+                req.params = params;
+                return &r.webSocketHandler;
+            }
+        }
+        return nullptr;
+    }
+
+    // Every method on path goes to the named upstream in "upstreams", target
+    // and query string unchanged. Global middleware runs first; over HTTP/1.1
+    // the response streams through, so changes a layer makes to it are lost.
+    void addProxyRoute(const std::string& path, const std::string& upstream) {
+        std::cout << "[+] [Router] Proxy route created: " << path << " -> " << upstream << std::endl;
+        proxyRoutes.push_back({ splitPath(path), upstream });
+    }
+
+    const std::string* matchProxy(Request& req) {
+        if (proxyRoutes.empty()) return nullptr;
+
+        std::string normalizedPath = normalizePath(req.path);
+        if (normalizedPath.empty()) return nullptr;
+
+        for (auto& r : proxyRoutes) {
+            std::unordered_map<std::string, std::string> params;
+            if (matchRoute(r.parts, splitPath(normalizedPath), params)) {
+                req.params = params;
+                return &r.upstream;
+            }
+        }
+        return nullptr;
     }
 
-    Response route(Request& req) {
-        if (req.body.size() > MAX_REQUEST_SIZE) {
-            return Response().setStatus(HttpStatus::PayloadTooLarge);
+    Task<Response> route(Request& req) {
+        if (middleware.empty()) return dispatch(req);
+        return runMiddleware(req);
+    }
+
+    // Runs the global middleware with through in place of the router, for
+    // requests the server answers itself (HTTP/1.1 proxying).
+    Task<Response> routeThrough(Request& req, Middleware::Endpoint through) {
+        Middleware::Next next(middleware, through);
+        co_return co_await next(req);
+    }
+
+private:
+    struct Route {
+        std::string method;
+        std::vector<std::string> parts;
+        Handler handler;
+        AsyncHandler asyncHandler;          // WebSocket routes: the middleware before the handshake
+        WebSocketHandler webSocketHandler;
+        bool parsesBody = false;    // the middleware chain parses the body itself
+        PartHandler onPart;
+    };
+
+    struct ProxyRoute {
+        std::vector<std::string> parts;
+        std::string upstream;
+    };
+
+    std::vector<Route> routes;
+    std::vector<Route> webSocketRoutes;
+    std::vector<ProxyRoute> proxyRoutes;
+    std::vector<Middleware::Layer> middleware;
+    Middleware::Endpoint endpoint;
+
+    Task<Response> runMiddleware(Request& req) {
+        Middleware::Next next(middleware, endpoint);
+        co_return co_await next(req);
+    }
+
+    Task<Response> dispatch(Request& req) {
+        // HTTP/1.1 proxy requests never get here; HTTP/2 ones are buffered.
+        if (const std::string* upstream = matchProxy(req)) {
+            co_return co_await ReverseProxy::forward(*upstream, req);
+        }
+
+        // Pinned: the handler may resume after a reload.
+        std::shared_ptr<const Settings> settings = Config::current();
+        const size_t maxRequestSize = settings->maxRequestSize;
+        const std::filesystem::path publicPath = settings->publicPath;
+
+        if (req.body.size() > maxRequestSize) {
+            co_return Response().setStatus(HttpStatus::PayloadTooLarge);
         }
 
         std::string normalizedPath = normalizePath(req.path);
         if (normalizedPath.empty()) {
-            return Response().setStatus(HttpStatus::BadRequest);
+            co_return Response().setStatus(HttpStatus::BadRequest);
         }
 
         for (auto& r : routes) {
@@ -72,52 +253,92 @@ public:
             std::unordered_map<std::string, std::string> params;
             if (matchRoute(r.parts, splitPath(normalizedPath), params)) {
                 req.params = params;
+                if (r.onPart) {
+                    req.onPart = [&req, &onPart = r.onPart](const UploadedFile& part, std::string_view data, bool end) {
+                        return onPart(req, part, data, end);
+                    };
+                }
 
-                if (req.method == "POST" || req.method == "PUT") {
-                    if (req.contentType.empty()) req.contentType = "application/json";
-
-                    if (req.contentType == "application/x-www-form-urlencoded") {
-                        req.form = parseParams(req.body);
-                    } else if (req.contentType == "application/json") {
-                        try {
-                            req.json = json::parse(req.body);
-                        } catch (...) {
-                            return Response().setStatus(HttpStatus::UnprocessableEntity);
-                        }
-                    } else {
-                        return Response().setStatus(HttpStatus::UnsupportedMediaType);
-                    }
+                if (!r.parsesBody) {
+                    HttpStatus status = co_await parseBody(req);
+                    if (status != HttpStatus::OK) co_return Response().setStatus(status);
                 }
-                return r.handler(req);
+
+                if (r.asyncHandler) {
+                    co_return co_await r.asyncHandler(req);
+                }
+                co_return r.handler(req);
             }
         }
 
         if (req.method == "GET" && !publicPath.empty()) {
             std::string publicFilePath = publicPath.string() + normalizedPath;
 
-            if (publicFilePath.find("..") == std::string::npos && std::filesystem::exists(publicFilePath)) {
-                std::ifstream f(publicFilePath, std::ios::binary);
-                std::ostringstream ss;
-                ss << f.rdbuf();
+            if (publicFilePath.find("..") == std::string::npos && std::filesystem::is_regular_file(publicFilePath)) {
+                std::string content;
+                if (co_await EventLoop::current()->readFile(publicFilePath, content)) {
+                    Response res;
+                    res.setBody(content);
 
-                Response res;
-                res.setBody(ss.str());
+                    co_return res.setStatus(HttpStatus::OK);
+                }
+            }
+        }
 
-                return res.setStatus(HttpStatus::OK);
+        co_return Response().setStatus(HttpStatus::NotFound);
+    }
+
+    // Reads POST and PUT bodies into the request: form fields, multipart
+    // uploads or JSON. OK, or the status to answer with.
+    static Task<HttpStatus> parseBody(Request& req) {
+        std::shared_ptr<const Settings> settings = Config::current();
+        const size_t maxRequestSize = settings->maxRequestSize;
+        const std::filesystem::path uploadPath = settings->uploadPath;
+
+        if (req.method == "POST" || req.method == "PUT") {
+            if (req.contentType.empty()) req.contentType = "application/json";
+            std::string boundary = MultipartParser::boundaryOf(req.contentType);
+
+            if (req.contentType == "application/x-www-form-urlencoded") {
+                req.form = parseParams(req.body);
+            } else if (!boundary.empty()) {
+                // HTTP/1.1 uploads stream in from here; HTTP/2 bodies have
+                // arrived whole.
+                if (req.readBody) {
+                    if (!co_await req.readBody()) co_return HttpStatus::BadRequest;
+                } else {
+                    // An empty body lacks even the closing boundary.
+                    MultipartUpload upload(*EventLoop::current(), req, boundary, maxRequestSize, uploadPath);
+                    if (co_await upload.feed(req.body.data(), req.body.size()) != MultipartUpload::Result::Done) {
+                        co_return HttpStatus::BadRequest;
+                    }
+                }
+            } else if (req.contentType == "application/json") {
+                try {
+                    req.json = json::parse(req.body);
+                } catch (...) {
+                    co_return HttpStatus::UnprocessableEntity;
+                }
+            } else {
+                co_return HttpStatus::UnsupportedMediaType;
             }
         }
 
-        return Response().setStatus(HttpStatus::NotFound);
+        co_return HttpStatus::OK;
     }
 
-private:
-    struct Route {
-        std::string method;
-        std::vector<std::string> parts;
-        Handler handler;
-    };
+    static Response switching(Request&) {
+        Response response;
+        response.setStatus(HttpStatus::SwitchingProtocols);
+        return response;
+    }
 
-    std::vector<Route> routes;
+    template <typename RouteHandler>
+    static Task<Response> parseBodyThen(RouteHandler& handler, Request& req) {
+        HttpStatus status = co_await parseBody(req);
+        if (status != HttpStatus::OK) co_return Response().setStatus(status);
+        co_return co_await Middleware::Detail::invoke(handler, req);
+    }
 
     static std::string normalizeMethod(const std::string& method) {
         std::string result = method;
@@ -142,35 +363,6 @@ private:
         return parts;
     }
 
-    static std::string normalizePath(const std::string& path) {
-        std::vector<std::string> parts;
-        std::stringstream ss(path);
-        std::string segment;
-
-        while (std::getline(ss, segment, '/')) {
-            if (segment.empty() || segment == ".") {
-                continue;
-            }
-
-            if (segment == "..") {
-                if (parts.empty()) {
-                    return "";
-                }
-                parts.pop_back();
-            } else {
-                parts.push_back(segment);
-            }
-        }
-
-        std::string normalized;
-
-        for (const auto& part : parts) {
-            normalized += "/" + part;
-        }
-
-        return normalized.empty() ? "/" : normalized;
-    }
-
     static bool matchRoute(const std::vector<std::string>& routeParts, const std::vector<std::string>& pathParts, std::unordered_map<std::string, std::string>& params) {
         size_t i = 0;
         for (; i < routeParts.size(); i++) {
@@ -1,58 +1,153 @@
 #include <WS2tcpip.h>
+#include <MSWSock.h>
+#include <future>
 
 #include "Server.hpp"
 #include "Router.hpp"
 #include "Config.hpp"
+#include "Compression.hpp"
+#include "RequestParser.hpp"
+#include "Multipart.hpp"
+#include "Proxy.hpp"
+#include "Topology.hpp"
 
 #pragma comment(lib, "ws2_32.lib")
 
-Server::Server() {
+Server::Server(SOCKET inherited) {
 
-    Config& config = Config::getInstance();
+    std::shared_ptr<const Settings> settings = Config::current();
+    const Settings& config = *settings;
+    port = config.port;
 
-    serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (serverSocket == INVALID_SOCKET) {
-        throw std::runtime_error("Socket creation failed");
+    if (inherited != INVALID_SOCKET) {
+        // Already bound and listening in the process we took over from.
+        serverSocket = inherited;
+    } else {
+        serverSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (serverSocket == INVALID_SOCKET) {
+            throw std::runtime_error("Socket creation failed");
+        }
+
+        BOOL opt = TRUE;
+        setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+
+        sockaddr_in serverAddr{};
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(config.port);
+        inet_pton(AF_INET, config.host.c_str(), &serverAddr.sin_addr);
+
+        if (bind(serverSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) != 0) {
+            closesocket(serverSocket);
+            throw std::runtime_error("Bind failed");
+        }
+
+        // Beyond SOMAXCONN's default (~200) Windows only honours explicit hints.
+        int backlog = config.backlog > 200 ? SOMAXCONN_HINT(config.backlog) : config.backlog;
+        if (listen(serverSocket, backlog) != 0) {
+            closesocket(serverSocket);
+            throw std::runtime_error("Listen failed");
+        }
     }
 
-    BOOL opt = TRUE;
-    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, (const char*)&opt, sizeof(opt));
+    std::cout << "[*] [Server] Server listening on " << config.host.c_str() << ":" << config.port << "\n";
 
-    sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(config.port);
-    inet_pton(AF_INET, config.host.c_str(), &serverAddr.sin_addr);
+    admission = std::make_unique<AdmissionControl>(config.maxConnections, config.maxConnectionsPerIp,
+        std::chrono::milliseconds(config.keepAliveTimeout), std::chrono::milliseconds(config.minKeepAliveTimeout));
 
-    if (bind(serverSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) != 0) {
-        closesocket(serverSocket);
-        throw std::runtime_error("Bind failed");
+    // Everything else reads the snapshot per request; only admission keeps copies.
+    reloadListener = Config::getInstance().onReload([this](const Settings& reloaded) {
+        admission->configure(reloaded.maxConnections, reloaded.maxConnectionsPerIp,
+            std::chrono::milliseconds(reloaded.keepAliveTimeout), std::chrono::milliseconds(reloaded.minKeepAliveTimeout));
+    });
+
+    if (config.tlsEnabled) {
+        try {
+            tls = std::make_unique<TlsContext>(config.tlsCertificateSubject, config.tlsCertificateStore);
+        } catch (...) {
+            closesocket(serverSocket);
+            throw;
+        }
+        if (config.http2Enabled) {
+            tls->setApplicationProtocols({ "h2", "http/1.1" });
+        }
+        std::cout << "[*] [Server] TLS enabled." << "\n";
     }
 
-    if (listen(serverSocket, 20) != 0) {
-        closesocket(serverSocket);
-        throw std::runtime_error("Listen failed");
+    // Each loop keeps to its own processor, so the connections it owns stay in
+    // that core's caches; empty when cpu.affinity leaves placement to Windows.
+    std::vector<CpuSlot> placement = CpuTopology::getInstance().plan(config);
+
+    for (int i = 0; i < config.threads; ++i) {
+        loops.push_back(std::make_unique<EventLoop>(config.ioBatchSize));
+        if (!placement.empty()) loops.back()->place(placement[i], config.cpuNumaLocalMemory);
+        loops.back()->start();
+        idleConnections[loops.back().get()];
+        http2Sessions[loops.back().get()];
+        webSockets[loops.back().get()];
     }
 
-    std::cout << "[*] [Server] Server listening on " << config.host.c_str() << ":" << config.port << "\n";
+    std::vector<EventLoop*> loopList;
+    for (auto& loop : loops) loopList.push_back(loop.get());
+    Upstreams::getInstance().configure(config.upstreams, loopList);
 
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        workers.emplace_back(&Server::workerThread, this);
+    useAcceptEx = config.ioBackend == "acceptex";
+    if (useAcceptEx) {
+        GUID acceptExId = WSAID_ACCEPTEX;
+        GUID sockaddrsId = WSAID_GETACCEPTEXSOCKADDRS;
+        DWORD bytes = 0;
+
+        if (WSAIoctl(serverSocket, SIO_GET_EXTENSION_FUNCTION_POINTER, &acceptExId, sizeof(acceptExId), &acceptEx, sizeof(acceptEx), &bytes, nullptr, nullptr) != 0 ||
+            WSAIoctl(serverSocket, SIO_GET_EXTENSION_FUNCTION_POINTER, &sockaddrsId, sizeof(sockaddrsId), &getAcceptExSockaddrs, sizeof(getAcceptExSockaddrs), &bytes, nullptr, nullptr) != 0) {
+            closesocket(serverSocket);
+            throw std::runtime_error("Unable to load AcceptEx");
+        }
+
+        // Accept completions land on the first loop, which keeps ioAcceptDepth
+        // accepts outstanding so bursts are absorbed without a syscall per client.
+        EventLoop& acceptLoop = *loops.front();
+        if (!acceptLoop.attach(serverSocket)) {
+            // A socket is bound to one completion port for its lifetime, so an
+            // inherited listener the old process had attached cannot join ours.
+            if (inherited == INVALID_SOCKET) {
+                closesocket(serverSocket);
+                throw std::runtime_error("Unable to attach listening socket");
+            }
+            std::cout << "[*] [Server] Inherited listener is bound to another completion port, AcceptEx completes by event." << "\n";
+            acceptExByEvent = true;
+        }
+
+        for (int i = 0; !acceptExByEvent && i < config.ioAcceptDepth; ++i) {
+            acceptLoop.post([this, &acceptLoop]() {
+                spawn(acceptClients(acceptLoop));
+            });
+        }
     }
 }
 
 Server::~Server() {
-    for (int i = 0; i < NUM_THREADS; ++i) {
-        clientQueue.push({ INVALID_SOCKET, {} });
-    }
-    for (auto& t : workers) {
-        if (t.joinable()) {
-            t.join();
-        }
+    Config::getInstance().removeListener(reloadListener);
+
+    closeListener();
+
+    for (auto& loop : loops) {
+        loop->stop();
     }
-    closesocket(serverSocket);
 }
 
 void Server::run(WSAEVENT& shutdownEvent) {
+    // A replacement process may take the listener at any time; once it has,
+    // this one stops as if asked to shut down.
+    SocketHandover handover(port, serverSocket, shutdownEvent);
+
+    if (acceptExByEvent) {
+        acceptByEvent(shutdownEvent);
+        return;
+    }
+    if (useAcceptEx) {
+        WSAWaitForMultipleEvents(1, &shutdownEvent, FALSE, WSA_INFINITE, FALSE);
+        return;
+    }
+
     WSAEVENT serverEvent = WSACreateEvent();
     WSAEventSelect(serverSocket, serverEvent, FD_ACCEPT);
 
@@ -85,190 +180,701 @@ void Server::run(WSAEVENT& shutdownEvent) {
                         }
                         break;
                     }
-                    clientQueue.push({ clientSocket, clientAddr });
+                    dispatchClient(clientSocket, clientAddr);
                 }
             }
         }
     }
     WSACloseEvent(serverEvent);
 }
-void Server::handleClient(SOCKET clientSocket, const sockaddr_in& clientAddr) {
-    char clientIp[INET_ADDRSTRLEN];
-    inet_ntop(AF_INET, &clientAddr.sin_addr, clientIp, INET_ADDRSTRLEN);
 
-    DWORD timeout = 5000;
-    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
-    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
-
-    Router& router = Router::getInstance();
+void Server::acceptByEvent(WSAEVENT shutdownEvent) {
+    const DWORD addressSize = sizeof(sockaddr_in) + 16;
+    // closeListener may reset serverSocket from another thread; a closed
+    // handle only fails the pending accepts.
+    const SOCKET listener = serverSocket;
+
+    struct PendingAccept {
+        OVERLAPPED overlapped{};
+        WSAEVENT event = WSA_INVALID_EVENT;
+        SOCKET socket = INVALID_SOCKET;
+        char addresses[2 * (sizeof(sockaddr_in) + 16)];
+    };
+
+    // One wait slot is the shutdown event.
+    const int depth = std::min(Config::current()->ioAcceptDepth, WSA_MAXIMUM_WAIT_EVENTS - 1);
+    std::vector<PendingAccept> accepts(depth);
+    std::vector<WSAEVENT> events;
+
+    auto arm = [this, listener, addressSize](PendingAccept& accept) {
+        if (!accepting) return;
+        accept.socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+        if (accept.socket == INVALID_SOCKET) {
+            std::cout << "[!] [Server] WSASocket() failed: " << WSAGetLastError() << std::endl;
+            return;
+        }
 
-    bool keepAlive = true;
-    try {
-        while (keepAlive) {
-            fd_set read_fds{};
-            FD_ZERO(&read_fds);
-            FD_SET(clientSocket, &read_fds);
+        // The low bit of hEvent keeps the completion off the old process's port.
+        accept.overlapped = OVERLAPPED{};
+        accept.overlapped.hEvent = reinterpret_cast<HANDLE>(reinterpret_cast<ULONG_PTR>(accept.event) | 1);
+        DWORD bytes = 0;
+        if (!acceptEx(listener, accept.socket, accept.addresses, 0, addressSize, addressSize, &bytes, &accept.overlapped) &&
+            WSAGetLastError() != WSA_IO_PENDING) {
+            std::cout << "[!] [Server] AcceptEx() failed: " << WSAGetLastError() << std::endl;
+            closesocket(accept.socket);
+            accept.socket = INVALID_SOCKET;
+        }
+    };
 
-            timeval timeout_val;
-            timeout_val.tv_sec = 5;
-            timeout_val.tv_usec = 0;
+    for (PendingAccept& accept : accepts) {
+        accept.event = WSACreateEvent();
+        events.push_back(accept.event);
+        arm(accept);
+    }
+    events.push_back(shutdownEvent);
 
-            int select_result = select(0, &read_fds, NULL, NULL, &timeout_val);
-            if (select_result <= 0) break;
+    while (true) {
+        DWORD wait = WSAWaitForMultipleEvents(static_cast<DWORD>(events.size()), events.data(), FALSE, WSA_INFINITE, FALSE);
+        if (wait == WSA_WAIT_FAILED || wait >= WSA_WAIT_EVENT_0 + static_cast<DWORD>(depth)) break;
+
+        PendingAccept& accept = accepts[wait - WSA_WAIT_EVENT_0];
+        WSAResetEvent(accept.event);
+
+        DWORD bytes = 0;
+        DWORD flags = 0;
+        if (WSAGetOverlappedResult(listener, &accept.overlapped, &bytes, FALSE, &flags)) {
+            setsockopt(accept.socket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (const char*)&listener, sizeof(listener));
+
+            sockaddr* localAddr = nullptr;
+            sockaddr* remoteAddr = nullptr;
+            int localLen = 0;
+            int remoteLen = 0;
+            getAcceptExSockaddrs(accept.addresses, 0, addressSize, addressSize, &localAddr, &localLen, &remoteAddr, &remoteLen);
+
+            sockaddr_in clientAddr{};
+            if (remoteAddr != nullptr && remoteLen >= static_cast<int>(sizeof(clientAddr))) {
+                memcpy(&clientAddr, remoteAddr, sizeof(clientAddr));
+            }
+            dispatchClient(accept.socket, clientAddr);
+        } else {
+            if (accepting) {
+                std::cout << "[!] [Server] AcceptEx() failed: " << WSAGetLastError() << std::endl;
+            }
+            closesocket(accept.socket);
+        }
+        accept.socket = INVALID_SOCKET;
+        arm(accept);
+    }
 
-            std::string requestString;
-            std::vector<char> buffer(1024);
-            size_t totalBytesRead = 0;
-            const size_t maxRequestSize = router.getMaxRequestSize();
+    // The overlapped structures live here; wait out the cancelled accepts.
+    CancelIoEx(reinterpret_cast<HANDLE>(listener), nullptr);
+    for (PendingAccept& accept : accepts) {
+        if (accept.socket != INVALID_SOCKET) {
+            DWORD bytes = 0;
+            DWORD flags = 0;
+            WSAGetOverlappedResult(listener, &accept.overlapped, &bytes, TRUE, &flags);
+            closesocket(accept.socket);
+        }
+        WSACloseEvent(accept.event);
+    }
+}
 
-            while (totalBytesRead < maxRequestSize) {
-                int bytesRead = recv(clientSocket, buffer.data(), static_cast<int>(buffer.size()), 0);
-                if (bytesRead <= 0) break;
-                requestString.append(buffer.data(), bytesRead);
-                totalBytesRead += bytesRead;
-                if (requestString.find("\r\n\r\n") != std::string::npos) break;
+void Server::drain(std::chrono::milliseconds timeout) {
+    // Stop accepting. After a handover the new process holds its own handle to
+    // the listener, so closing ours leaves the socket and its backlog open.
+    draining = true;
+    closeListener();
+
+    // Idle keep-alive connections have nothing left to finish; expire them on
+    // the next tick. Connections going idle from here on close on their own.
+    // HTTP/2 clients get GOAWAY so they open no new streams, WebSocket peers
+    // 1001 Going Away; sessions starting later see draining and do the same.
+    for (auto& loop : loops) {
+        EventLoop* target = loop.get();
+        target->post([this, target]() {
+            for (Connection* connection : idleConnections.find(target)->second) {
+                connection->deadline.arm(std::chrono::milliseconds(0));
+            }
+            for (Http2Connection* session : http2Sessions.find(target)->second) {
+                session->goAway();
+            }
+            for (WebSocket* socket : webSockets.find(target)->second) {
+                socket->close(1001);
             }
+        });
+    }
+
+    size_t remaining = admission->activeConnections();
+    std::cout << "[*] [Server] Draining " << remaining << " connections..." << std::endl;
 
-            if (requestString.empty() || totalBytesRead >= maxRequestSize) break;
+    auto giveUp = std::chrono::steady_clock::now() + timeout;
+    while ((remaining = admission->activeConnections()) > 0 && std::chrono::steady_clock::now() < giveUp) {
+        Sleep(50);
+    }
 
-            if (requestString.find("Connection: close") != std::string::npos) keepAlive = false;
+    if (remaining > 0) {
+        std::cout << "[!] [Server] Drain timed out, closing " << remaining << " connections." << std::endl;
+    } else {
+        std::cout << "[*] [Server] Drained." << std::endl;
+    }
+}
 
-            std::istringstream requestStream(requestString);
+void Server::closeListener() {
+    accepting = false;
+
+    // AcceptEx reads serverSocket on the accept loop; close it there so the
+    // handle never changes under a pending accept.
+    auto close = [this]() {
+        if (serverSocket == INVALID_SOCKET) return;
+        CancelIoEx(reinterpret_cast<HANDLE>(serverSocket), nullptr);
+        closesocket(serverSocket);
+        serverSocket = INVALID_SOCKET;
+    };
+
+    if (!useAcceptEx || acceptExByEvent) {
+        close();
+        return;
+    }
 
-            Request request = parseRequest(requestStream);
-            Response response = router.route(request);
+    std::promise<void> closed;
+    loops.front()->post([&close, &closed]() {
+        close();
+        closed.set_value();
+    });
+    closed.get_future().wait();
+}
 
-            std::ostringstream responseStream;
-            responseStream << "HTTP/1.1 " << response.statusCode << "\r\n";
-            responseStream << "Content-Type: " << response.contentType << "\r\n";
-            responseStream << "Content-Length: " << response.contentLength << "\r\n";
-            responseStream << (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
-            responseStream << "\r\n";
-            responseStream << response.body;
+std::chrono::milliseconds Server::idleTimeout() const {
+    if (draining) return std::chrono::milliseconds(0);
+    return admission->idleTimeout();
+}
+Task<void> Server::acceptClients(EventLoop& loop) {
+    const DWORD addressSize = sizeof(sockaddr_in) + 16;
+    char addresses[2 * addressSize];
+
+    while (accepting) {
+        SOCKET clientSocket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+        if (clientSocket == INVALID_SOCKET) {
+            std::cout << "[!] [Server] WSASocket() failed: " << WSAGetLastError() << std::endl;
+            co_await loop.sleep(std::chrono::milliseconds(100));
+            continue;
+        }
 
-            std::string responseStr = responseStream.str();
-            int totalSent = 0;
-            while (totalSent < (int)responseStr.size()) {
-                int sent = send(clientSocket, responseStr.c_str() + totalSent, (int)responseStr.size() - totalSent, 0);
-                if (sent <= 0) break;
-                totalSent += sent;
+        if (!co_await loop.accept(acceptEx, serverSocket, clientSocket, addresses)) {
+            closesocket(clientSocket);
+            if (accepting) {
+                std::cout << "[!] [Server] AcceptEx() failed." << std::endl;
             }
+            continue;
+        }
+
+        setsockopt(clientSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (const char*)&serverSocket, sizeof(serverSocket));
+
+        sockaddr* localAddr = nullptr;
+        sockaddr* remoteAddr = nullptr;
+        int localLen = 0;
+        int remoteLen = 0;
+        getAcceptExSockaddrs(addresses, 0, addressSize, addressSize, &localAddr, &localLen, &remoteAddr, &remoteLen);
 
+        sockaddr_in clientAddr{};
+        if (remoteAddr != nullptr && remoteLen >= static_cast<int>(sizeof(clientAddr))) {
+            memcpy(&clientAddr, remoteAddr, sizeof(clientAddr));
         }
+
+        dispatchClient(clientSocket, clientAddr);
     }
-    catch (...) {
-        std::cout << "[!] [Server] Unexpected exception." << std::endl;
+}
+
+void Server::dispatchClient(SOCKET clientSocket, const sockaddr_in& clientAddr) {
+    // accept() copies the listening socket's event selection; drop it so the
+    // client socket is driven purely by overlapped I/O on its loop. Reads drain
+    // the socket with non-blocking recv() after a zero-byte wake-up.
+    if (!useAcceptEx) WSAEventSelect(clientSocket, nullptr, 0);
+
+    u_long nonBlocking = 1;
+    ioctlsocket(clientSocket, FIONBIO, &nonBlocking);
+
+    switch (admission->admit(clientAddr.sin_addr.s_addr)) {
+    case AdmissionControl::Decision::RejectServerFull:
+        rejectClient(clientSocket, HttpStatus::ServiceUnavailable);
+        return;
+    case AdmissionControl::Decision::RejectIpLimit:
+        rejectClient(clientSocket, HttpStatus::TooManyRequests);
+        return;
+    default:
+        break;
     }
 
-    closesocket(clientSocket);
+    EventLoop& loop = pickLoop();
+    if (!loop.attach(clientSocket)) {
+        std::cout << "[!] [Server] Failed to attach client socket: " << GetLastError() << std::endl;
+        closesocket(clientSocket);
+        admission->release(clientAddr.sin_addr.s_addr);
+        return;
+    }
+
+    loop.connectionOpened();
+
+    // Accepted on the target loop already: start inline instead of posting.
+    if (EventLoop::current() == &loop) {
+        spawn(handleClient(loop, clientSocket, clientAddr));
+        return;
+    }
+
+    loop.post([this, &loop, clientSocket, clientAddr]() {
+        spawn(handleClient(loop, clientSocket, clientAddr));
+    });
 }
 
-void Server::workerThread() {
-    while (true) {
-        ClientInfo client = clientQueue.pop();
-        if (client.socket == INVALID_SOCKET) break;
+void Server::rejectClient(SOCKET clientSocket, HttpStatus status) {
+    Response response;
+    response.setStatus(status).setHeader("Retry-After", "1");
+    std::string head = serializeHead(response, false);
+
+    // Best effort, and never on the accepting thread: an overloaded server
+    // must not wait on a client it is turning away.
+    EventLoop& loop = pickLoop();
+    if (turningAway.fetch_add(1, std::memory_order_relaxed) >= MAX_TURNING_AWAY || !loop.attach(clientSocket)) {
+        turningAway.fetch_sub(1, std::memory_order_relaxed);
+        send(clientSocket, head.c_str(), static_cast<int>(head.size()), 0);
+        closesocket(clientSocket);
+        return;
+    }
 
-        try {
-            handleClient(client.socket, client.addr);
-        }
-        catch (const std::exception& e) {
-            std::cerr << "[!] [Server] Worker thread caught exception: " << e.what() << std::endl;
-            closesocket(client.socket);
+    loop.post([this, &loop, clientSocket, head = std::move(head)]() mutable {
+        spawn(turnAway(loop, clientSocket, std::move(head)));
+    });
+}
+
+Task<void> Server::turnAway(EventLoop& loop, SOCKET clientSocket, std::string head) {
+    // Closing with the request still unread makes the stack send RST, which
+    // can discard the response before the client reads it. Send, shut down
+    // our side and read until the client closes too, for a short while.
+    const auto giveUp = std::chrono::steady_clock::now() + REJECT_LINGER;
+    if (co_await loop.sendAll(clientSocket, head, std::string(), REJECT_LINGER)) {
+        shutdown(clientSocket, SD_SEND);
+
+        std::string discard;
+        while (true) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(giveUp - std::chrono::steady_clock::now());
+            if (left.count() <= 0) break;
+
+            discard.clear();
+            if (co_await loop.receive(clientSocket, discard, left) <= 0) break;
         }
-        catch (...) {
-            std::cerr << "[!] [Server] Worker thread caught unknown exception." << std::endl;
-            closesocket(client.socket);
+    }
+
+    closesocket(clientSocket);
+    turningAway.fetch_sub(1, std::memory_order_relaxed);
+}
+
+EventLoop& Server::pickLoop() {
+    // Keep-alive connections are long-lived, so balance on live connections
+    // rather than round-robin; ties rotate so an idle server still spreads out.
+    size_t start = nextLoop++ % loops.size();
+    EventLoop* best = loops[start].get();
+    for (size_t i = 1; i < loops.size(); ++i) {
+        EventLoop* candidate = loops[(start + i) % loops.size()].get();
+        if (candidate->connectionCount() < best->connectionCount()) {
+            best = candidate;
         }
     }
+    return *best;
 }
 
-Request Server::parseRequest(std::istringstream& stream)
-{
-    Request req;
-
-    std::string requestLine;
-    std::getline(stream, requestLine);
-    std::istringstream rl(requestLine);
-    rl >> req.method;
-    rl >> req.path;
-    rl >> req.protocol;
-
-    std::string headerLine;
-    while (std::getline(stream, headerLine))
-    {
-        if (headerLine == "\r" || headerLine.empty())
-            break;
-
-        size_t colonPos = headerLine.find(':');
-        if (colonPos == std::string::npos)
-            continue;
+Task<void> Server::handleClient(EventLoop& loop, SOCKET clientSocket, sockaddr_in clientAddr) {
+    // Pinned for the connection and refreshed between requests, so a reload
+    // applies from the next request without touching one in flight.
+    std::shared_ptr<const Settings> settings = Config::current();
+    std::chrono::milliseconds headerTimeout(settings->headerTimeout);
+    std::chrono::milliseconds bodyTimeout(settings->bodyTimeout);
+    std::chrono::milliseconds writeTimeout(settings->writeTimeout);
+    size_t maxRequestSize = settings->maxRequestSize;
+
+    // One timer per connection, re-armed as the connection moves between the
+    // handshake, idle, header, body and write phases. The header deadline covers
+    // the whole head, so trickling a byte at a time (slowloris) does not extend it.
+    Connection connection(loop, clientSocket, clientAddr);
+    Deadline& deadline = connection.deadline;
+    std::unordered_set<Connection*>& idle = idleConnections.find(&loop)->second;
+
+    std::string pending;
+    bool keepAlive = true;
+    try {
+        if (tls) {
+            connection.tls = std::make_unique<TlsSession>(*tls);
+            deadline.arm(headerTimeout);
+            keepAlive = co_await connection.tls->handshake(loop, clientSocket);
+
+            if (keepAlive && connection.tls->applicationProtocol() == "h2") {
+                co_await serveHttp2(connection, std::string(), nullptr, std::string());
+                keepAlive = false;
+            }
+        }
 
-        std::string key = headerLine.substr(0, colonPos);
-        std::string value = headerLine.substr(colonPos + 1);
+        while (keepAlive) {
+            std::string requestString = std::move(pending);
+            pending.clear();
+
+            settings = Config::current();
+            headerTimeout = std::chrono::milliseconds(settings->headerTimeout);
+            bodyTimeout = std::chrono::milliseconds(settings->bodyTimeout);
+            writeTimeout = std::chrono::milliseconds(settings->writeTimeout);
+            maxRequestSize = settings->maxRequestSize;
+
+            if (requestString.empty() && draining) break;
+            deadline.arm(requestString.empty() ? idleTimeout() : headerTimeout);
+
+            size_t headerEnd = requestString.find("\r\n\r\n");
+            while (headerEnd == std::string::npos && requestString.size() < maxRequestSize) {
+                bool wasIdle = requestString.empty();
+                size_t scanFrom = requestString.size() > 3 ? requestString.size() - 3 : 0;
+
+                // Registered while idle so a drain can close it straight away.
+                if (wasIdle) idle.insert(&connection);
+                int bytesRead = co_await connection.receive(requestString);
+                if (wasIdle) idle.erase(&connection);
+                if (bytesRead <= 0) break;
 
-        // trim key
-        key.erase(0, key.find_first_not_of(" \r\t"));
-        key.erase(key.find_last_not_of(" \r\t") + 1);
+                if (wasIdle) deadline.arm(headerTimeout);
+                headerEnd = requestString.find("\r\n\r\n", scanFrom);
+            }
 
-        // trim value
-        value.erase(0, value.find_first_not_of(" \r\t"));
-        value.erase(value.find_last_not_of(" \r\t") + 1);
+            if (headerEnd == std::string::npos) break;
 
-        req.headers[key] = value;
+            // HTTP/2 with prior knowledge: the client preface parses as a request head.
+            if (settings->http2Enabled && requestString.compare(0, 16, Http2Connection::PREFACE.substr(0, 16)) == 0) {
+                co_await serveHttp2(connection, std::move(requestString), nullptr, std::string());
+                break;
+            }
 
-        if (key == "Content-Type")
-            req.contentType = value;
+            const size_t bodyStart = headerEnd + 4;
+            std::istringstream requestStream(requestString.substr(0, bodyStart));
+            Request request;
+            HttpStatus rejection = HttpStatus::OK;
+            try {
+                request = parseRequest(requestStream);
+            } catch (const std::exception&) {
+                rejection = HttpStatus::BadRequest;
+            }
+            request.clientIp = connection.ip;
+            request.secure = connection.tls != nullptr;
+
+            auto connectionHeader = request.headers.find("Connection");
+            if (connectionHeader != request.headers.end()) {
+                std::string value = connectionHeader->second;
+                std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                if (value.find("close") != std::string::npos) keepAlive = false;
+            }
 
-        if (key == "Content-Length")
-            req.contentLength = std::stoi(value);
+            // Only the proxy passes chunked bodies on; nothing here decodes them.
+            const std::string* upstream = rejection == HttpStatus::OK ? Router::getInstance().matchProxy(request) : nullptr;
+            auto transferEncoding = request.headers.find("Transfer-Encoding");
+            if (rejection == HttpStatus::OK && transferEncoding != request.headers.end() &&
+                (upstream == nullptr || _stricmp(transferEncoding->second.c_str(), "chunked") != 0)) {
+                rejection = HttpStatus::NotImplemented;
+            }
+
+            // Where the body ends is unknown, so whatever follows cannot be
+            // read as another request.
+            if (rejection != HttpStatus::OK) {
+                Response response;
+                response.setStatus(rejection);
+                deadline.arm(writeTimeout);
+                co_await connection.send(serializeHead(response, false), response.body);
+                break;
+            }
 
-        if (key == "User-Agent")
-            req.userAgent = value;
+            // Proxied bodies stream through in both directions, so neither the
+            // body limits nor buffering apply.
+            if (upstream != nullptr) {
+                ReverseProxy::Options options;
+                options.bodyTimeout = bodyTimeout;
+                options.writeTimeout = writeTimeout;
+                options.keepAlive = keepAlive && !draining;
+
+                pending = requestString.substr(bodyStart);
+                deadline.disarm();
+
+                bool relayed = false;
+                Response refused = co_await Router::getInstance().routeThrough(request, [&](Request& req) -> Task<Response> {
+                    relayed = true;
+                    keepAlive = co_await ReverseProxy::relay(connection, *upstream, req, pending, options);
+                    co_return Response();
+                });
+                if (relayed) continue;
+
+                // A layer answered in the upstream's place; the body is unread.
+                deadline.arm(writeTimeout);
+                co_await connection.send(serializeHead(refused, false), refused.body);
+                break;
+            }
 
-        if (key == "Cookie") {
-            std::stringstream cs(value);
-            std::string kv;
-            while (std::getline(cs, kv, ';')) {
-                size_t eq = kv.find('=');
-                if (eq == std::string::npos) continue;
+            const size_t contentLength = request.contentLength > 0 ? static_cast<size_t>(request.contentLength) : 0;
+            Response response;
+
+            // Multipart bodies are parsed as they arrive, with file parts going
+            // straight to disk, so they are held to the upload limit instead.
+            const std::string boundary = MultipartParser::boundaryOf(request.contentType);
+            const size_t bodyLimit = boundary.empty() ? maxRequestSize : settings->maxUploadSize;
+
+            if (contentLength > bodyLimit) {
+                response.setStatus(HttpStatus::PayloadTooLarge);
+                keepAlive = false;
+            } else if (!boundary.empty()) {
+                // Nothing is written to disk until a route has matched and the
+                // middleware has let the request through: the router calls
+                // readBody just before the handler.
+                const std::filesystem::path uploadPath = settings->uploadPath;
+                bool connected = true;
+                bool complete = false;
+
+                request.readBody = [&]() -> Task<bool> {
+                    MultipartUpload upload(loop, request, boundary, maxRequestSize, uploadPath);
+
+                    size_t received = std::min(requestString.size() - bodyStart, contentLength);
+                    pending = requestString.substr(bodyStart + received);
+                    MultipartUpload::Result result = co_await upload.feed(requestString.data() + bodyStart, received);
+
+                    // Only the chunk in hand is buffered; the deadline is per chunk
+                    // so large uploads are bounded by progress, not total time.
+                    std::string chunk;
+                    while (result != MultipartUpload::Result::Error && received < contentLength) {
+                        deadline.arm(bodyTimeout);
+                        chunk.clear();
+                        if (co_await connection.receive(chunk) <= 0) {
+                            connected = false;
+                            break;
+                        }
 
-                std::string ckey = kv.substr(0, eq);
-                std::string cval = kv.substr(eq + 1);
+                        size_t take = std::min(chunk.size(), contentLength - received);
+                        result = co_await upload.feed(chunk.data(), take);
+                        received += take;
+                        pending = chunk.substr(take);
+                    }
+                    deadline.disarm();
+
+                    complete = result == MultipartUpload::Result::Done;
+                    co_return complete;
+                };
+
+                deadline.disarm();
+                response = co_await respond(request);
+                if (!connected) break;
+
+                // A body that was rejected, or never read, is still on the wire.
+                if (!complete) keepAlive = false;
+            } else {
+                if (requestString.size() < bodyStart + contentLength) {
+                    deadline.arm(bodyTimeout);
+                    while (requestString.size() < bodyStart + contentLength) {
+                        int bytesRead = co_await connection.receive(requestString);
+                        if (bytesRead <= 0) break;
+                    }
+                    if (requestString.size() < bodyStart + contentLength) break;
+                }
 
-                ckey.erase(0, ckey.find_first_not_of(" \r\t"));
-                ckey.erase(ckey.find_last_not_of(" \r\t") + 1);
-                cval.erase(0, cval.find_first_not_of(" \r\t"));
-                cval.erase(cval.find_last_not_of(" \r\t") + 1);
+                request.body = requestString.substr(bodyStart, contentLength);
+                pending = requestString.substr(bodyStart + contentLength);
 
-                req.cookies[urlDecode(ckey)] = urlDecode(cval);
+                auto upgrade = request.headers.find("Upgrade");
+                if (upgrade != request.headers.end() && _stricmp(upgrade->second.c_str(), "websocket") == 0) {
+                    co_await serveWebSocket(connection, request, std::move(pending));
+                    break;
+                }
+
+                // h2c upgrade (RFC 7540 3.2); requests with a body stay on HTTP/1.1.
+                auto http2SettingsHeader = request.headers.find("HTTP2-Settings");
+                if (settings->http2Enabled && !connection.tls && contentLength == 0 &&
+                    upgrade != request.headers.end() && upgrade->second == "h2c" && http2SettingsHeader != request.headers.end()) {
+                    std::string http2Settings = http2SettingsHeader->second;
+                    static const std::string switching = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+
+                    // Answered here, middleware and all, before the switch;
+                    // the response goes out as stream 1.
+                    deadline.disarm();
+                    auto answer = std::make_unique<Response>(co_await respond(request));
+
+                    deadline.arm(writeTimeout);
+                    if (!co_await connection.send(switching, std::string())) break;
+
+                    co_await serveHttp2(connection, std::move(pending), std::make_unique<Request>(std::move(request)), std::move(http2Settings), std::move(answer));
+                    break;
+                }
+
+                deadline.disarm();
+                response = co_await respond(request);
             }
+
+            if (draining) keepAlive = false;
+            std::string head = serializeHead(response, keepAlive);
+
+            deadline.arm(writeTimeout);
+            if (!co_await connection.send(head, response.body)) break;
         }
     }
-
-    if (req.contentLength > 0) {
-        std::string body(req.contentLength, '\0');
-        stream.read(&body[0], req.contentLength);
-        req.body = body;
+    catch (const std::exception& e) {
+        std::cerr << "[!] [Server] Connection handler caught exception: " << e.what() << std::endl;
     }
+    catch (...) {
+        std::cout << "[!] [Server] Unexpected exception." << std::endl;
+    }
+
+    deadline.arm(writeTimeout);
+    co_await connection.shutdown();
+    deadline.disarm();
 
-    auto pos = req.path.find('?');
-    if (pos != std::string::npos) {
-        std::string qs = req.path.substr(pos + 1);
-        req.path = req.path.substr(0, pos);
+    closesocket(clientSocket);
+    loop.connectionClosed();
+    admission->release(clientAddr.sin_addr.s_addr);
+}
 
-        std::stringstream ss(qs);
-        std::string kv;
-        while (std::getline(ss, kv, '&')) {
-            size_t eq = kv.find('=');
-            if (eq == std::string::npos) continue;
+Task<void> Server::serveHttp2(Connection& connection, std::string input, std::unique_ptr<Request> upgraded, std::string settings,
+    std::unique_ptr<Response> answer) {
+    std::shared_ptr<const Settings> pinned = Config::current();
+    const Settings& config = *pinned;
+
+    Http2Connection::Options options;
+    options.maxConcurrentStreams = static_cast<uint32_t>(config.http2MaxConcurrentStreams);
+    options.initialWindowSize = static_cast<uint32_t>(config.http2InitialWindowSize);
+    options.maxRequestSize = config.maxRequestSize;
+    options.bodyTimeout = std::chrono::milliseconds(config.bodyTimeout);
+    options.writeTimeout = std::chrono::milliseconds(config.writeTimeout);
+    options.idleTimeout = [this]() {
+        return idleTimeout();
+    };
+
+    Http2Connection http2(connection, [this](Request& request) {
+        return respond(request);
+    }, std::move(options));
+
+    std::unordered_set<Http2Connection*>& sessions = http2Sessions.find(&connection.loop)->second;
+    sessions.insert(&http2);
+    if (draining) http2.goAway();
+
+    co_await http2.run(std::move(input), std::move(upgraded), settings, std::move(answer));
+    sessions.erase(&http2);
+}
+
+Task<void> Server::serveWebSocket(Connection& connection, Request& request, std::string input) {
+    std::shared_ptr<const Settings> settings = Config::current();
+    const Settings& config = *settings;
+    Router& router = Router::getInstance();
+    const Router::WebSocketHandler* handler = router.matchWebSocket(request);
 
-            auto key = urlDecode(kv.substr(0, eq));
-            auto value = urlDecode(kv.substr(eq + 1));
-            req.query[key] = value;
+    auto key = request.headers.find("Sec-WebSocket-Key");
+    auto version = request.headers.find("Sec-WebSocket-Version");
+
+    Response rejection;
+    if (handler != nullptr && (request.method != "GET" || key == request.headers.end())) {
+        rejection.setStatus(HttpStatus::BadRequest);
+    } else if (handler != nullptr && (version == request.headers.end() || version->second != "13")) {
+        rejection.setStatus(HttpStatus::UpgradeRequired).setHeader("Sec-WebSocket-Version", "13");
+    }
+
+    // Middleware decides before the handshake; headers it adds go on the 101.
+    bool refused = rejection.statusCode != static_cast<int>(HttpStatus::OK);
+    Response admitted;
+    if (!refused) {
+        admitted = co_await router.admitWebSocket(request, handler);
+        if (admitted.statusCode != static_cast<int>(HttpStatus::SwitchingProtocols)) {
+            rejection = std::move(admitted);
+            refused = true;
         }
     }
 
-    req.path = urlDecode(req.path);
+    connection.deadline.arm(std::chrono::milliseconds(config.writeTimeout));
+
+    if (refused) {
+        co_await connection.send(serializeHead(rejection, false), rejection.body);
+        co_return;
+    }
+
+    std::ostringstream head;
+    head << "HTTP/1.1 " << static_cast<int>(HttpStatus::SwitchingProtocols) << " " << reasonPhrase(HttpStatus::SwitchingProtocols) << "\r\n";
+    for (const auto& [name, value] : admitted.headers) {
+        if (_stricmp(name.c_str(), "Content-Type") == 0 || _stricmp(name.c_str(), "Content-Length") == 0) continue;
+        head << name << ": " << value << "\r\n";
+    }
+    head << "Upgrade: websocket\r\n";
+    head << "Connection: Upgrade\r\n";
+    head << "Sec-WebSocket-Accept: " << WebSocket::acceptKey(key->second) << "\r\n\r\n";
+    if (!co_await connection.send(head.str(), std::string())) co_return;
+
+    // Liveness is tracked by ping/pong from here on, not by the HTTP deadlines.
+    connection.deadline.disarm();
+
+    WebSocket::Options options;
+    options.maxMessageSize = config.webSocketMaxMessageSize;
+    options.maxQueuedFrames = static_cast<size_t>(config.webSocketMaxQueuedFrames);
+    options.pingInterval = std::chrono::milliseconds(config.webSocketPingInterval);
+    options.writeTimeout = std::chrono::milliseconds(config.writeTimeout);
+
+    WebSocket socket(connection, options, std::move(input));
+    std::unordered_set<WebSocket*>& sockets = webSockets.find(&connection.loop)->second;
+    sockets.insert(&socket);
+    if (draining) socket.close(1001);
+
+    try {
+        co_await (*handler)(socket, request);
+    } catch (const std::exception& e) {
+        std::cerr << "[!] [Server] WebSocket handler threw: " << e.what() << std::endl;
+        socket.close(1011);
+    }
+    sockets.erase(&socket);
+    co_await socket.finish();
+}
+
+Task<Response> Server::respond(Request& request) {
+    Response response = co_await Router::getInstance().route(request);
+    compressResponse(request, response);
+
+    // Uploaded files the handler has not moved away are temporary.
+    for (const UploadedFile& file : request.files) {
+        std::error_code ec;
+        std::filesystem::remove(file.path, ec);
+    }
+    co_return response;
+}
+
+void Server::compressResponse(const Request& request, Response& response) {
+    std::shared_ptr<const Settings> settings = Config::current();
+    const Settings& config = *settings;
+
+    if (!config.compressionEnabled || request.acceptEncoding.empty()) return;
+    if (response.body.size() < config.compressionMinSize) return;
+    if (!isCompressibleType(response.contentType)) return;
+    if (response.headers.count("Content-Encoding")) return;
+
+    ContentEncoding encoding = negotiateEncoding(request.acceptEncoding);
+    if (encoding == ContentEncoding::Identity) return;
+
+    CompressionBudget budget(config.compressionWorkers);
+    if (!budget) return;
+
+    std::string compressed;
+    if (!Compressor::forThread(encoding).compress(response.body, compressed, config.compressionLevel)) return;
+    if (compressed.size() >= response.body.size()) return;
+
+    response.setBody(compressed);
+    response.setHeader("Content-Encoding", contentEncodingName(encoding));
+
+    // Keep what a layer already varies on (Cors adds Origin).
+    auto vary = response.headers.find("Vary");
+    response.setHeader("Vary", vary == response.headers.end() || vary->second.empty() ? "Accept-Encoding" : vary->second + ", Accept-Encoding");
+}
+
+std::string Server::serializeHead(const Response& response, bool keepAlive) {
+    std::ostringstream responseStream;
+    responseStream << "HTTP/1.1 " << response.statusCode << " " << response.reason << "\r\n";
+    responseStream << "Content-Type: " << response.contentType << "\r\n";
+    responseStream << "Content-Length: " << response.contentLength << "\r\n";
+    for (const auto& [key, value] : response.headers) {
+        if (key == "Content-Type" || key == "Content-Length") continue;
+        responseStream << key << ": " << value << "\r\n";
+    }
+    responseStream << (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    responseStream << "\r\n";
 
-    return req;
+    return responseStream.str();
 }
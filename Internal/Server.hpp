@@ -1,63 +1,82 @@
 #pragma once
 
 #include <WinSock2.h>
+#include <MSWSock.h>
+#include <atomic>
 #include <sstream>
-#include <thread>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
 
 #include "Request.hpp"
+#include "Response.hpp"
+#include "EventLoop.hpp"
+#include "Admission.hpp"
+#include "Connection.hpp"
+#include "Http2.hpp"
+#include "WebSocket.hpp"
+#include "Tls.hpp"
+#include "Handover.hpp"
 
 using namespace HTTP;
 
-struct ClientInfo {
-    SOCKET socket;
-    sockaddr_in addr;
-};
-
-template<typename T>
-class SafeQueue {
-private:
-    std::queue<T> queue_;
-    std::mutex mtx_;
-    std::condition_variable cv_;
-public:
-    void push(T value);
-    T pop();
-};
-
 class Server {
 private:
-    const int NUM_THREADS = 4;
     SOCKET serverSocket;
-    SafeQueue<ClientInfo> clientQueue;
-    std::vector<std::thread> workers;
+    int port = 0;
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    size_t nextLoop = 0;
+    std::unique_ptr<AdmissionControl> admission;
+    std::unique_ptr<TlsContext> tls;
+    int reloadListener = -1;
+
+    bool useAcceptEx = false;
+    // AcceptEx on a listener inherited already attached to the old process's
+    // completion port: completions are signalled by event, on the run() thread.
+    bool acceptExByEvent = false;
+    std::atomic<bool> accepting{ true };
+    std::atomic<bool> draining{ false };
+    // Rejected clients still lingering; past MAX_TURNING_AWAY they are reset.
+    std::atomic<int> turningAway{ 0 };
+    static constexpr int MAX_TURNING_AWAY = 1024;
+    static constexpr std::chrono::milliseconds REJECT_LINGER{ 1000 };
+
+    // Per loop, connections waiting for their next request. Each set is only
+    // touched from its own loop thread.
+    std::unordered_map<EventLoop*, std::unordered_set<Connection*>> idleConnections;
+    // Per loop, HTTP/2 sessions and WebSockets, told to wind down (GOAWAY,
+    // 1001 Going Away) when the server drains. Loop thread only, like the above.
+    std::unordered_map<EventLoop*, std::unordered_set<Http2Connection*>> http2Sessions;
+    std::unordered_map<EventLoop*, std::unordered_set<WebSocket*>> webSockets;
+    LPFN_ACCEPTEX acceptEx = nullptr;
+    LPFN_GETACCEPTEXSOCKADDRS getAcceptExSockaddrs = nullptr;
 
-    void handleClient(SOCKET clientSocket, const sockaddr_in& clientAddr);
-    void workerThread();
+    Task<void> acceptClients(EventLoop& loop);
+    void acceptByEvent(WSAEVENT shutdownEvent);
+    void closeListener();
+    EventLoop& pickLoop();
+    void dispatchClient(SOCKET clientSocket, const sockaddr_in& clientAddr);
+    void rejectClient(SOCKET clientSocket, HttpStatus status);
+    Task<void> turnAway(EventLoop& loop, SOCKET clientSocket, std::string head);
+    Task<void> handleClient(EventLoop& loop, SOCKET clientSocket, sockaddr_in clientAddr);
+    Task<void> serveHttp2(Connection& connection, std::string input, std::unique_ptr<Request> upgraded, std::string settings,
+        std::unique_ptr<Response> answer = nullptr);
+    Task<void> serveWebSocket(Connection& connection, Request& request, std::string input);
+    Task<Response> respond(Request& request);
 
-    Request parseRequest(std::istringstream& stream);
+    void compressResponse(const Request& request, Response& response);
+    std::string serializeHead(const Response& response, bool keepAlive);
+    std::chrono::milliseconds idleTimeout() const;
 
 public:
-    Server();
+    // inherited: a listening socket taken over from a previous process, or
+    // INVALID_SOCKET to bind one.
+    explicit Server(SOCKET inherited = INVALID_SOCKET);
     ~Server();
     void run(WSAEVENT& shutdownEvent);
-};
 
-template<typename T>
-void SafeQueue<T>::push(T value) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    queue_.push(std::move(value));
-    cv_.notify_one();
-}
-
-template<typename T>
-T SafeQueue<T>::pop() {
-    std::unique_lock<std::mutex> lock(mtx_);
-    cv_.wait(lock, [this]() { return !queue_.empty(); });
-    T val = std::move(queue_.front());
-    queue_.pop();
-    return val;
-}
+    // Stops accepting, closes idle connections and waits up to timeout for
+    // in-flight requests to finish.
+    void drain(std::chrono::milliseconds timeout);
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+// Hierarchical hashed timer wheel (4 levels x 64 slots, 10 ms ticks, ~46 h range).
+// Timers are intrusive list nodes owned by the caller, so scheduling, re-arming
+// and cancelling are O(1) and allocation-free; a timer only moves between levels
+// when its slot cascades. Not thread-safe: owned by a single event loop.
+class TimerWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds TICK{ 10 };
+
+    struct Node {
+        Node* prev = nullptr;
+        Node* next = nullptr;
+    };
+
+    class Timer : private Node {
+    private:
+        friend class TimerWheel;
+
+        uint64_t expiresTick = 0;
+        TimerWheel* wheel = nullptr;
+
+    public:
+        std::function<void()> callback;
+
+        Timer() = default;
+        explicit Timer(std::function<void()> callback) : callback(std::move(callback)) {}
+
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        ~Timer() {
+            if (wheel) wheel->cancel(*this);
+        }
+
+        bool scheduled() const {
+            return wheel != nullptr;
+        }
+    };
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr uint64_t SLOTS = 1ull << SLOT_BITS;
+    static constexpr uint64_t MAX_TICKS = (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+    // Circular list heads; an empty slot points at itself.
+    Node slots[LEVELS][SLOTS];
+    Clock::time_point origin;
+    uint64_t currentTick = 0;
+    size_t count = 0;
+
+    Node* head(int level, uint64_t slot) {
+        return &slots[level][slot];
+    }
+
+    uint64_t ticksAt(Clock::time_point time) const {
+        if (time <= origin) return 0;
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(time - origin) / TICK);
+    }
+
+    void link(Timer& timer) {
+        uint64_t delta = timer.expiresTick > currentTick ? timer.expiresTick - currentTick : 0;
+
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ull << (SLOT_BITS * (level + 1)))) {
+            ++level;
+        }
+
+        uint64_t slot = (timer.expiresTick >> (SLOT_BITS * level)) & (SLOTS - 1);
+        Node* list = head(level, slot);
+
+        timer.prev = list->prev;
+        timer.next = list;
+        list->prev->next = &timer;
+        list->prev = &timer;
+    }
+
+    static void unlink(Node& timer) {
+        timer.prev->next = timer.next;
+        timer.next->prev = timer.prev;
+        timer.prev = nullptr;
+        timer.next = nullptr;
+    }
+
+    void cascade(int level, uint64_t slot) {
+        Node* list = head(level, slot);
+        while (list->next != list) {
+            Timer* timer = static_cast<Timer*>(list->next);
+            unlink(*timer);
+            link(*timer);
+        }
+    }
+
+public:
+    TimerWheel() : origin(Clock::now()) {
+        for (int level = 0; level < LEVELS; ++level) {
+            for (uint64_t slot = 0; slot < SLOTS; ++slot) {
+                slots[level][slot].prev = &slots[level][slot];
+                slots[level][slot].next = &slots[level][slot];
+            }
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // (Re)arms timer to fire once delay has elapsed (at most one tick late).
+    void schedule(Timer& timer, std::chrono::milliseconds delay) {
+        cancel(timer);
+
+        if (delay.count() < 0) delay = std::chrono::milliseconds(0);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - origin);
+        uint64_t expires = static_cast<uint64_t>((elapsed + delay + TICK - std::chrono::milliseconds(1)) / TICK);
+
+        // Always at least the next tick, and never beyond what the top level holds.
+        if (expires <= currentTick) expires = currentTick + 1;
+        if (expires - currentTick > MAX_TICKS) expires = currentTick + MAX_TICKS;
+
+        timer.expiresTick = expires;
+        timer.wheel = this;
+        link(timer);
+        ++count;
+    }
+
+    void cancel(Timer& timer) {
+        if (timer.wheel != this) return;
+
+        unlink(timer);
+        timer.wheel = nullptr;
+        --count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    // Fires every timer that is due. Callbacks may schedule or cancel timers.
+    void advance() {
+        uint64_t target = ticksAt(Clock::now());
+
+        while (currentTick < target) {
+            ++currentTick;
+
+            for (int level = 1; level < LEVELS; ++level) {
+                if ((currentTick & ((1ull << (SLOT_BITS * level)) - 1)) != 0) break;
+                cascade(level, (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+            }
+
+            Node* list = head(0, currentTick & (SLOTS - 1));
+            while (list->next != list) {
+                Timer* timer = static_cast<Timer*>(list->next);
+                unlink(*timer);
+                timer->wheel = nullptr;
+                --count;
+                if (timer->callback) timer->callback();
+            }
+        }
+    }
+
+    // How long the owning loop may block before advance() has work to do.
+    std::chrono::milliseconds nextTimeout() const {
+        if (count == 0) return std::chrono::milliseconds::max();
+
+        uint64_t now = ticksAt(Clock::now());
+        uint64_t behind = now > currentTick ? now - currentTick : 0;
+        if (behind > 0) return std::chrono::milliseconds(0);
+
+        // Nearest occupied level-0 slot, or the next cascade boundary.
+        for (uint64_t i = 1; i <= SLOTS; ++i) {
+            uint64_t tick = currentTick + i;
+            const Node& slot = slots[0][tick & (SLOTS - 1)];
+            if (slot.next != &slot || (tick & (SLOTS - 1)) == 0) {
+                return TICK * static_cast<long long>(i);
+            }
+        }
+        return TICK * static_cast<long long>(SLOTS);
+    }
+};
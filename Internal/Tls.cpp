@@ -0,0 +1,306 @@
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "Tls.hpp"
+
+#pragma comment(lib, "secur32.lib")
+#pragma comment(lib, "crypt32.lib")
+
+namespace {
+    constexpr ULONG ACCEPT_FLAGS = ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY |
+        ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM;
+
+    // Encrypted records are sent once this much has built up, so a large
+    // response never has all of its ciphertext in memory at once.
+    constexpr size_t SEND_BATCH = 64 * 1024;
+
+    std::wstring widen(const std::string& s) {
+        return std::wstring(s.begin(), s.end());
+    }
+
+    // Reads more ciphertext from the socket into buffer; false on close or error.
+    Task<bool> readMore(EventLoop& loop, SOCKET socket, std::string& buffer) {
+        co_return co_await loop.receive(socket, buffer) > 0;
+    }
+}
+
+TlsContext::TlsContext(const std::string& certificateSubject, const std::string& certificateStore) {
+    DWORD location = certificateStore == "LocalMachine" ? CERT_SYSTEM_STORE_LOCAL_MACHINE : CERT_SYSTEM_STORE_CURRENT_USER;
+
+    store = CertOpenStore(CERT_STORE_PROV_SYSTEM_W, 0, 0, location | CERT_STORE_READONLY_FLAG, L"MY");
+    if (store == nullptr) {
+        throw std::runtime_error("Unable to open certificate store");
+    }
+
+    std::wstring subject = widen(certificateSubject);
+    certificate = CertFindCertificateInStore(store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0, CERT_FIND_SUBJECT_STR_W, subject.c_str(), nullptr);
+    if (certificate == nullptr) {
+        CertCloseStore(store, 0);
+        throw std::runtime_error("TLS certificate '" + certificateSubject + "' not found");
+    }
+
+    SCHANNEL_CRED credential{};
+    credential.dwVersion = SCHANNEL_CRED_VERSION;
+    credential.cCreds = 1;
+    credential.paCred = &certificate;
+    credential.dwFlags = SCH_USE_STRONG_CRYPTO;
+
+    TimeStamp expiry;
+    SECURITY_STATUS status = AcquireCredentialsHandleW(nullptr, const_cast<LPWSTR>(UNISP_NAME_W), SECPKG_CRED_INBOUND,
+        nullptr, &credential, nullptr, nullptr, &credentials, &expiry);
+    if (status != SEC_E_OK) {
+        CertFreeCertificateContext(certificate);
+        CertCloseStore(store, 0);
+        throw std::runtime_error("AcquireCredentialsHandle failed");
+    }
+}
+
+TlsContext::~TlsContext() {
+    FreeCredentialsHandle(&credentials);
+    CertFreeCertificateContext(certificate);
+    CertCloseStore(store, 0);
+}
+
+void TlsContext::setApplicationProtocols(const std::vector<std::string>& protocols) {
+    std::string wire;
+    for (const std::string& name : protocols) {
+        wire.push_back(static_cast<char>(name.size()));
+        wire += name;
+    }
+
+    const size_t listOffset = offsetof(SEC_APPLICATION_PROTOCOLS, ProtocolLists);
+    const size_t dataOffset = offsetof(SEC_APPLICATION_PROTOCOL_LIST, ProtocolList);
+
+    alpn.assign(listOffset + dataOffset + wire.size(), 0);
+    auto* header = reinterpret_cast<SEC_APPLICATION_PROTOCOLS*>(alpn.data());
+    header->ProtocolListsSize = static_cast<unsigned long>(dataOffset + wire.size());
+
+    auto* list = reinterpret_cast<SEC_APPLICATION_PROTOCOL_LIST*>(alpn.data() + listOffset);
+    list->ProtoNegoExt = SecApplicationProtocolNegotiationExt_ALPN;
+    list->ProtocolListSize = static_cast<unsigned short>(wire.size());
+    memcpy(alpn.data() + listOffset + dataOffset, wire.data(), wire.size());
+}
+
+TlsSession::~TlsSession() {
+    if (hasContext) DeleteSecurityContext(&securityContext);
+}
+
+Task<bool> TlsSession::handshake(EventLoop& loop, SOCKET socket) {
+    std::string input;
+
+    while (true) {
+        if (input.empty() && !co_await readMore(loop, socket, input)) co_return false;
+
+        std::vector<char>& alpn = context.applicationProtocols();
+
+        SecBuffer inBuffers[3];
+        inBuffers[0] = { static_cast<ULONG>(input.size()), SECBUFFER_TOKEN, input.data() };
+        inBuffers[1] = { 0, SECBUFFER_EMPTY, nullptr };
+        inBuffers[2] = { static_cast<ULONG>(alpn.size()), SECBUFFER_APPLICATION_PROTOCOLS, alpn.data() };
+        SecBufferDesc inDesc{ SECBUFFER_VERSION, alpn.empty() ? 2ul : 3ul, inBuffers };
+
+        SecBuffer outBuffers[1];
+        outBuffers[0] = { 0, SECBUFFER_TOKEN, nullptr };
+        SecBufferDesc outDesc{ SECBUFFER_VERSION, 1, outBuffers };
+
+        ULONG attributes = 0;
+        TimeStamp expiry;
+        SECURITY_STATUS status = AcceptSecurityContext(context.handle(), hasContext ? &securityContext : nullptr, &inDesc,
+            ACCEPT_FLAGS, 0, hasContext ? nullptr : &securityContext, &outDesc, &attributes, &expiry);
+
+        if (status == SEC_E_INCOMPLETE_MESSAGE) {
+            if (!co_await readMore(loop, socket, input)) co_return false;
+            continue;
+        }
+
+        if (status == SEC_E_OK || status == SEC_I_CONTINUE_NEEDED) {
+            hasContext = true;
+        }
+
+        if (outBuffers[0].cbBuffer > 0 && outBuffers[0].pvBuffer != nullptr) {
+            std::string token(static_cast<const char*>(outBuffers[0].pvBuffer), outBuffers[0].cbBuffer);
+            FreeContextBuffer(outBuffers[0].pvBuffer);
+            if (!co_await loop.sendAll(socket, token, std::string())) co_return false;
+        }
+
+        if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) co_return false;
+
+        // Unconsumed bytes are the start of the next handshake message, or the
+        // first application records once the handshake is complete.
+        std::string extra;
+        if (inBuffers[1].BufferType == SECBUFFER_EXTRA && inBuffers[1].cbBuffer > 0) {
+            extra = input.substr(input.size() - inBuffers[1].cbBuffer);
+        }
+        input = std::move(extra);
+
+        if (status == SEC_E_OK) {
+            encrypted = std::move(input);
+
+            SecPkgContext_ApplicationProtocol negotiated{};
+            if (!alpn.empty() &&
+                QueryContextAttributesW(&securityContext, SECPKG_ATTR_APPLICATION_PROTOCOL, &negotiated) == SEC_E_OK &&
+                negotiated.ProtoNegoStatus == SecApplicationProtocolNegotiationStatus_Success) {
+                protocol.assign(reinterpret_cast<const char*>(negotiated.ProtocolId), negotiated.ProtocolIdSize);
+            }
+
+            co_return QueryContextAttributesW(&securityContext, SECPKG_ATTR_STREAM_SIZES, &sizes) == SEC_E_OK;
+        }
+    }
+}
+
+Task<int> TlsSession::receive(EventLoop& loop, SOCKET socket, std::string& out) {
+    while (true) {
+        if (!encrypted.empty()) {
+            SecBuffer buffers[4];
+            buffers[0] = { static_cast<ULONG>(encrypted.size()), SECBUFFER_DATA, encrypted.data() };
+            buffers[1] = { 0, SECBUFFER_EMPTY, nullptr };
+            buffers[2] = { 0, SECBUFFER_EMPTY, nullptr };
+            buffers[3] = { 0, SECBUFFER_EMPTY, nullptr };
+            SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+
+            SECURITY_STATUS status = DecryptMessage(&securityContext, &desc, 0, nullptr);
+
+            if (status == SEC_I_CONTEXT_EXPIRED) co_return 0;
+
+            if (status == SEC_E_OK || status == SEC_I_RENEGOTIATE) {
+                int plaintext = 0;
+                std::string extra;
+                for (const SecBuffer& buffer : buffers) {
+                    if (buffer.BufferType == SECBUFFER_DATA && buffer.cbBuffer > 0) {
+                        out.append(static_cast<const char*>(buffer.pvBuffer), buffer.cbBuffer);
+                        plaintext += static_cast<int>(buffer.cbBuffer);
+                    } else if (buffer.BufferType == SECBUFFER_EXTRA && buffer.cbBuffer > 0) {
+                        extra.assign(static_cast<const char*>(buffer.pvBuffer), buffer.cbBuffer);
+                    }
+                }
+                encrypted.clear();
+
+                // A post-handshake message (TLS 1.3 KeyUpdate or
+                // NewSessionTicket, or a renegotiation): it is in extra, and
+                // goes back to AcceptSecurityContext before reading on.
+                if (status == SEC_I_RENEGOTIATE) {
+                    if (!co_await continueHandshake(loop, socket, std::move(extra))) co_return -1;
+                } else {
+                    encrypted = std::move(extra);
+                }
+
+                if (plaintext > 0) co_return plaintext;
+                continue;
+            }
+
+            if (status != SEC_E_INCOMPLETE_MESSAGE) co_return -1;
+        }
+
+        int bytesRead = co_await loop.receive(socket, encrypted);
+        if (bytesRead <= 0) co_return bytesRead;
+    }
+}
+
+Task<bool> TlsSession::continueHandshake(EventLoop& loop, SOCKET socket, std::string input) {
+    while (true) {
+        if (input.empty() && !co_await readMore(loop, socket, input)) co_return false;
+
+        SecBuffer inBuffers[2];
+        inBuffers[0] = { static_cast<ULONG>(input.size()), SECBUFFER_TOKEN, input.data() };
+        inBuffers[1] = { 0, SECBUFFER_EMPTY, nullptr };
+        SecBufferDesc inDesc{ SECBUFFER_VERSION, 2, inBuffers };
+
+        SecBuffer outBuffers[1];
+        outBuffers[0] = { 0, SECBUFFER_TOKEN, nullptr };
+        SecBufferDesc outDesc{ SECBUFFER_VERSION, 1, outBuffers };
+
+        ULONG attributes = 0;
+        TimeStamp expiry;
+        SECURITY_STATUS status = AcceptSecurityContext(context.handle(), &securityContext, &inDesc, ACCEPT_FLAGS, 0, nullptr,
+            &outDesc, &attributes, &expiry);
+
+        if (status == SEC_E_INCOMPLETE_MESSAGE) {
+            if (!co_await readMore(loop, socket, input)) co_return false;
+            continue;
+        }
+
+        if (outBuffers[0].cbBuffer > 0 && outBuffers[0].pvBuffer != nullptr) {
+            std::string token(static_cast<const char*>(outBuffers[0].pvBuffer), outBuffers[0].cbBuffer);
+            FreeContextBuffer(outBuffers[0].pvBuffer);
+            if (!co_await loop.sendAll(socket, token, std::string())) co_return false;
+        }
+
+        if (status != SEC_E_OK && status != SEC_I_CONTINUE_NEEDED) co_return false;
+
+        std::string extra;
+        if (inBuffers[1].BufferType == SECBUFFER_EXTRA && inBuffers[1].cbBuffer > 0) {
+            extra = input.substr(input.size() - inBuffers[1].cbBuffer);
+        }
+        input = std::move(extra);
+
+        if (status == SEC_E_OK) {
+            encrypted = std::move(input);
+
+            // A renegotiation may have changed the record sizes.
+            co_return QueryContextAttributesW(&securityContext, SECPKG_ATTR_STREAM_SIZES, &sizes) == SEC_E_OK;
+        }
+    }
+}
+
+Task<bool> TlsSession::sendAll(EventLoop& loop, SOCKET socket, const std::string& head, const std::string& body) {
+    const size_t maxMessage = sizes.cbMaximumMessage;
+    const size_t total = head.size() + body.size();
+
+    std::string records;
+    std::string message;
+    size_t offset = 0;
+
+    while (offset < total) {
+        size_t length = std::min(maxMessage, total - offset);
+
+        message.resize(sizes.cbHeader + length + sizes.cbTrailer);
+        char* data = message.data() + sizes.cbHeader;
+        size_t fromHead = offset < head.size() ? std::min(length, head.size() - offset) : 0;
+        if (fromHead > 0) std::memcpy(data, head.data() + offset, fromHead);
+        if (length > fromHead) std::memcpy(data + fromHead, body.data() + (offset + fromHead - head.size()), length - fromHead);
+
+        SecBuffer buffers[4];
+        buffers[0] = { sizes.cbHeader, SECBUFFER_STREAM_HEADER, message.data() };
+        buffers[1] = { static_cast<ULONG>(length), SECBUFFER_DATA, data };
+        buffers[2] = { sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, data + length };
+        buffers[3] = { 0, SECBUFFER_EMPTY, nullptr };
+        SecBufferDesc desc{ SECBUFFER_VERSION, 4, buffers };
+
+        if (EncryptMessage(&securityContext, 0, &desc, 0) != SEC_E_OK) co_return false;
+
+        records.append(message.data(), buffers[0].cbBuffer + buffers[1].cbBuffer + buffers[2].cbBuffer);
+        offset += length;
+
+        if (records.size() >= SEND_BATCH || offset == total) {
+            if (!co_await loop.sendAll(socket, records, std::string())) co_return false;
+            records.clear();
+        }
+    }
+
+    co_return true;
+}
+
+Task<void> TlsSession::shutdown(EventLoop& loop, SOCKET socket) {
+    if (!hasContext) co_return;
+
+    DWORD type = SCHANNEL_SHUTDOWN;
+    SecBuffer controlBuffer{ sizeof(type), SECBUFFER_TOKEN, &type };
+    SecBufferDesc controlDesc{ SECBUFFER_VERSION, 1, &controlBuffer };
+    if (ApplyControlToken(&securityContext, &controlDesc) != SEC_E_OK) co_return;
+
+    SecBuffer outBuffers[1];
+    outBuffers[0] = { 0, SECBUFFER_TOKEN, nullptr };
+    SecBufferDesc outDesc{ SECBUFFER_VERSION, 1, outBuffers };
+
+    ULONG attributes = 0;
+    TimeStamp expiry;
+    AcceptSecurityContext(context.handle(), &securityContext, nullptr, ACCEPT_FLAGS, 0, nullptr, &outDesc, &attributes, &expiry);
+
+    if (outBuffers[0].cbBuffer > 0 && outBuffers[0].pvBuffer != nullptr) {
+        std::string alert(static_cast<const char*>(outBuffers[0].pvBuffer), outBuffers[0].cbBuffer);
+        FreeContextBuffer(outBuffers[0].pvBuffer);
+        co_await loop.sendAll(socket, alert, std::string());
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#define SECURITY_WIN32
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <wincrypt.h>
+#include <security.h>
+#include <schannel.h>
+#include <string>
+#include <vector>
+
+#include "EventLoop.hpp"
+
+// Server credentials shared by every TLS connection. SChannel keys its session
+// cache on the credentials handle, so sharing one handle is what lets returning
+// clients resume with an abbreviated handshake.
+class TlsContext {
+private:
+    CredHandle credentials{};
+    PCCERT_CONTEXT certificate = nullptr;
+    HCERTSTORE store = nullptr;
+
+    // SEC_APPLICATION_PROTOCOLS buffer offered during the handshake (ALPN).
+    std::vector<char> alpn;
+
+public:
+    // Looks the certificate up by subject in the "MY" store of the current user
+    // or local machine. Throws std::runtime_error when it cannot be used.
+    TlsContext(const std::string& certificateSubject, const std::string& certificateStore);
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    CredHandle* handle() {
+        return &credentials;
+    }
+
+    // Protocols to offer through ALPN, most preferred first (e.g. "h2", "http/1.1").
+    void setApplicationProtocols(const std::vector<std::string>& protocols);
+
+    std::vector<char>& applicationProtocols() {
+        return alpn;
+    }
+};
+
+// One TLS connection: handshake, record encryption and decryption over a socket
+// attached to an EventLoop.
+class TlsSession {
+private:
+    TlsContext& context;
+    CtxtHandle securityContext{};
+    bool hasContext = false;
+    SecPkgContext_StreamSizes sizes{};
+    std::string protocol;
+
+    // Ciphertext received but not yet decrypted (partial records, or records
+    // that arrived together with the end of the handshake).
+    std::string encrypted;
+
+    // Feeds a post-handshake message back through AcceptSecurityContext;
+    // input starts with it, and whatever follows it ends up in encrypted.
+    Task<bool> continueHandshake(EventLoop& loop, SOCKET socket, std::string input);
+
+public:
+    explicit TlsSession(TlsContext& context) : context(context) {}
+    ~TlsSession();
+
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+
+    Task<bool> handshake(EventLoop& loop, SOCKET socket);
+
+    // Protocol selected through ALPN, empty when the client offered none.
+    const std::string& applicationProtocol() const {
+        return protocol;
+    }
+
+    // Appends decrypted application data to out. Resumes with the number of
+    // plaintext bytes, 0 on close_notify / orderly close, or -1 on error.
+    Task<int> receive(EventLoop& loop, SOCKET socket, std::string& out);
+
+    Task<bool> sendAll(EventLoop& loop, SOCKET socket, const std::string& head, const std::string& body);
+
+    // Sends close_notify (best effort).
+    Task<void> shutdown(EventLoop& loop, SOCKET socket);
+};
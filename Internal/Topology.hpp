@@ -0,0 +1,191 @@
+#pragma once
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "Config.hpp"
+
+// A logical processor, addressed as Windows does: a processor group and a
+// number within it.
+struct CpuSlot {
+    WORD group = 0;
+    BYTE number = 0;
+    DWORD node = 0;         // NUMA node
+    DWORD core = 0;         // physical core, shared by SMT siblings
+    bool sibling = false;   // not the first logical processor of its core
+};
+
+// The machine's processors, cores and NUMA nodes, read once with
+// GetLogicalProcessorInformationEx, and where the event loops should run.
+class CpuTopology {
+private:
+    std::vector<CpuSlot> processors;   // in (group, number) order: cpu.cpus indexes this
+    size_t cores = 0;
+    size_t nodes = 0;
+    size_t groups = 0;
+    DWORD error = 0;    // why enumerate() found no processors
+
+    CpuTopology() {
+        enumerate();
+    }
+
+    CpuTopology(const CpuTopology&) = delete;
+    CpuTopology& operator=(const CpuTopology&) = delete;
+
+    void enumerate() {
+        DWORD length = 0;
+        GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+        if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+            error = GetLastError();
+            return;
+        }
+
+        std::vector<char> buffer(length);
+        if (!GetLogicalProcessorInformationEx(RelationAll, reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data()), &length)) {
+            error = GetLastError();
+            return;
+        }
+
+        std::vector<std::pair<DWORD, GROUP_AFFINITY>> numa;
+        for (DWORD offset = 0; offset < length;) {
+            auto* info = reinterpret_cast<PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX>(buffer.data() + offset);
+
+            if (info->Relationship == RelationProcessorCore) {
+                bool first = true;
+                for (WORD g = 0; g < info->Processor.GroupCount; ++g) {
+                    const GROUP_AFFINITY& affinity = info->Processor.GroupMask[g];
+                    for (BYTE bit = 0; bit < sizeof(KAFFINITY) * 8; ++bit) {
+                        if (!(affinity.Mask & (static_cast<KAFFINITY>(1) << bit))) continue;
+
+                        CpuSlot slot;
+                        slot.group = affinity.Group;
+                        slot.number = bit;
+                        slot.core = static_cast<DWORD>(cores);
+                        slot.sibling = !first;
+                        processors.push_back(slot);
+                        first = false;
+                    }
+                }
+                ++cores;
+            } else if (info->Relationship == RelationNumaNode) {
+                // A node may span processor groups; GroupCount is 0 on systems
+                // older than Windows 11 / Server 2022, which report one mask.
+                WORD count = std::max<WORD>(info->NumaNode.GroupCount, 1);
+                for (WORD g = 0; g < count; ++g) {
+                    numa.emplace_back(info->NumaNode.NodeNumber, info->NumaNode.GroupMasks[g]);
+                }
+            }
+
+            offset += info->Size;
+        }
+
+        std::set<WORD> seenGroups;
+        for (CpuSlot& slot : processors) {
+            seenGroups.insert(slot.group);
+            for (const auto& [node, affinity] : numa) {
+                if (affinity.Group == slot.group && (affinity.Mask & (static_cast<KAFFINITY>(1) << slot.number))) {
+                    slot.node = node;
+                    break;
+                }
+            }
+        }
+
+        std::sort(processors.begin(), processors.end(), [](const CpuSlot& a, const CpuSlot& b) {
+            return a.group != b.group ? a.group < b.group : a.number < b.number;
+        });
+
+        std::set<DWORD> seenNodes;
+        for (const auto& [node, affinity] : numa) seenNodes.insert(node);
+        nodes = std::max<size_t>(seenNodes.size(), 1);
+        groups = seenGroups.size();
+    }
+
+public:
+    static const CpuTopology& getInstance() {
+        static CpuTopology instance;
+        return instance;
+    }
+
+    // One slot per event loop, or none when the scheduler places them. Physical
+    // cores come before SMT siblings, which would share a core's caches and
+    // execution units. "compact" takes the cores of one NUMA node before moving
+    // on to the next, keeping shared state in one node's memory; "spread"
+    // alternates between nodes for their combined memory bandwidth. With more
+    // loops than slots, slots are reused in order.
+    std::vector<CpuSlot> plan(const Settings& settings) const {
+        std::vector<CpuSlot> order;
+        if (!settings.cpuList.empty()) {
+            for (int cpu : settings.cpuList) {
+                if (static_cast<size_t>(cpu) < processors.size()) order.push_back(processors[cpu]);
+            }
+        } else if (settings.cpuAffinity != "none") {
+            std::map<DWORD, std::vector<CpuSlot>> primary;
+            std::map<DWORD, std::vector<CpuSlot>> siblings;
+            for (const CpuSlot& slot : processors) {
+                (slot.sibling ? siblings : primary)[slot.node].push_back(slot);
+            }
+
+            if (settings.cpuAffinity == "compact") {
+                for (auto* tier : { &primary, &siblings }) {
+                    for (const auto& [node, slots] : *tier) {
+                        order.insert(order.end(), slots.begin(), slots.end());
+                    }
+                }
+            } else {
+                for (auto* tier : { &primary, &siblings }) {
+                    for (size_t i = 0; ; ++i) {
+                        bool any = false;
+                        for (const auto& [node, slots] : *tier) {
+                            if (i < slots.size()) {
+                                order.push_back(slots[i]);
+                                any = true;
+                            }
+                        }
+                        if (!any) break;
+                    }
+                }
+            }
+        }
+
+        std::vector<CpuSlot> slots;
+        for (int i = 0; !order.empty() && i < settings.threads; ++i) {
+            slots.push_back(order[i % order.size()]);
+        }
+        return slots;
+    }
+
+    void outputTopology(const Settings& settings) const {
+        if (processors.empty()) {
+            std::cout << "[!] [Topology] Unable to read the processor topology: " << error << ", event loops are not pinned." << std::endl;
+            return;
+        }
+
+        std::cout << "[*] [Topology] " << processors.size() << " logical processors, " << cores << " cores, " << nodes << " NUMA nodes, " << groups << " processor groups." << std::endl;
+
+        for (int cpu : settings.cpuList) {
+            if (static_cast<size_t>(cpu) >= processors.size()) {
+                std::cout << "[!] [Topology] cpu.cpus entry " << cpu << " is out of range, ignored." << std::endl;
+            }
+        }
+
+        std::vector<CpuSlot> slots = plan(settings);
+        if (slots.empty()) {
+            std::cout << "[*] [Topology] Event loops are placed by the scheduler." << std::endl;
+            return;
+        }
+
+        for (size_t i = 0; i < slots.size(); ++i) {
+            const CpuSlot& slot = slots[i];
+            std::cout << "[*] [Topology] Event loop " << i << " on processor " << slot.group << ":" << static_cast<int>(slot.number)
+                << " (core " << slot.core << (slot.sibling ? ", SMT sibling" : "") << ", node " << slot.node << ")." << std::endl;
+        }
+        if (settings.cpuNumaLocalMemory && nodes > 1) {
+            std::cout << "[*] [Topology] Receive buffers and coroutine frames are allocated on each loop's NUMA node." << std::endl;
+        }
+    }
+};
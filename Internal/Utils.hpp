@@ -2,6 +2,7 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
 
 namespace Utils
 {
@@ -25,4 +26,35 @@ namespace Utils
         }
         return result;
     }
+
+    // Resolves "." and ".." segments and repeated slashes: "/a/./b//../c" is
+    // "/a/c". Empty when the path climbs above the root.
+    static std::string normalizePath(const std::string& path) {
+        std::vector<std::string> parts;
+        std::stringstream ss(path);
+        std::string segment;
+
+        while (std::getline(ss, segment, '/')) {
+            if (segment.empty() || segment == ".") {
+                continue;
+            }
+
+            if (segment == "..") {
+                if (parts.empty()) {
+                    return "";
+                }
+                parts.pop_back();
+            } else {
+                parts.push_back(segment);
+            }
+        }
+
+        std::string normalized;
+
+        for (const auto& part : parts) {
+            normalized += "/" + part;
+        }
+
+        return normalized.empty() ? "/" : normalized;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,443 @@
+#include <WinSock2.h>
+#include <Windows.h>
+#include <bcrypt.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define WEBSOCKET_SSE2 1
+#endif
+
+#include "WebSocket.hpp"
+
+#pragma comment(lib, "bcrypt.lib")
+
+namespace {
+    constexpr std::string_view ACCEPT_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    std::string base64Encode(const unsigned char* data, size_t size) {
+        static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        std::string out;
+        out.reserve((size + 2) / 3 * 4);
+        for (size_t i = 0; i < size; i += 3) {
+            uint32_t chunk = static_cast<uint32_t>(data[i]) << 16;
+            if (i + 1 < size) chunk |= static_cast<uint32_t>(data[i + 1]) << 8;
+            if (i + 2 < size) chunk |= data[i + 2];
+
+            out.push_back(alphabet[(chunk >> 18) & 0x3F]);
+            out.push_back(alphabet[(chunk >> 12) & 0x3F]);
+            out.push_back(i + 1 < size ? alphabet[(chunk >> 6) & 0x3F] : '=');
+            out.push_back(i + 2 < size ? alphabet[chunk & 0x3F] : '=');
+        }
+        return out;
+    }
+
+    bool validUtf8(const std::string& s) {
+        const auto* p = reinterpret_cast<const unsigned char*>(s.data());
+        const auto* end = p + s.size();
+
+        while (p < end) {
+            if (*p < 0x80) {
+                ++p;
+                continue;
+            }
+
+            int length;
+            uint32_t codepoint;
+            if ((*p & 0xE0) == 0xC0) { length = 2; codepoint = *p & 0x1F; }
+            else if ((*p & 0xF0) == 0xE0) { length = 3; codepoint = *p & 0x0F; }
+            else if ((*p & 0xF8) == 0xF0) { length = 4; codepoint = *p & 0x07; }
+            else return false;
+
+            if (end - p < length) return false;
+            for (int i = 1; i < length; ++i) {
+                if ((p[i] & 0xC0) != 0x80) return false;
+                codepoint = (codepoint << 6) | (p[i] & 0x3F);
+            }
+
+            // Overlong forms, surrogates and values beyond U+10FFFF.
+            static const uint32_t minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+            if (codepoint < minimum[length] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) return false;
+            p += length;
+        }
+        return true;
+    }
+
+    const std::string EMPTY;
+}
+
+WebSocket::WebSocket(Connection& connection, Options options, std::string input)
+    : connection(connection), options(options), input(std::move(input)) {
+    if (options.pingInterval.count() > 0) {
+        pingTimer.callback = [this]() {
+            onPingTimer();
+        };
+        connection.loop.schedule(pingTimer, options.pingInterval);
+    }
+}
+
+WebSocket::~WebSocket() {
+    connection.loop.cancel(pingTimer);
+
+    Broadcaster& broadcaster = Broadcaster::getInstance();
+    for (const std::string& topic : topics) {
+        broadcaster.unsubscribe(*this, connection.loop, topic);
+    }
+}
+
+std::string WebSocket::acceptKey(const std::string& key) {
+    std::string input = key;
+    input += ACCEPT_GUID;
+
+    unsigned char digest[20] = {};
+    BCryptHash(BCRYPT_SHA1_ALG_HANDLE, nullptr, 0, reinterpret_cast<PUCHAR>(input.data()), static_cast<ULONG>(input.size()), digest, sizeof(digest));
+    return base64Encode(digest, sizeof(digest));
+}
+
+void WebSocket::unmask(char* data, size_t size, const uint8_t key[4]) {
+    size_t i = 0;
+
+#ifdef WEBSOCKET_SSE2
+    // Blocks start at multiples of 16, so the key phase is the same in every lane group.
+    alignas(16) uint8_t pattern[16];
+    for (int k = 0; k < 16; ++k) pattern[k] = key[k & 3];
+    const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, mask));
+    }
+#endif
+
+    for (; i < size; ++i) {
+        data[i] = static_cast<char>(data[i] ^ key[i & 3]);
+    }
+}
+
+WebSocket::Frame WebSocket::encodeFrame(Opcode opcode, std::string_view payload) {
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(payload.size() + 10);
+
+    frame->push_back(static_cast<char>(0x80 | static_cast<uint8_t>(opcode)));
+    if (payload.size() < 126) {
+        frame->push_back(static_cast<char>(payload.size()));
+    } else if (payload.size() <= 0xFFFF) {
+        frame->push_back(static_cast<char>(126));
+        frame->push_back(static_cast<char>(payload.size() >> 8));
+        frame->push_back(static_cast<char>(payload.size()));
+    } else {
+        frame->push_back(static_cast<char>(127));
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame->push_back(static_cast<char>(static_cast<uint64_t>(payload.size()) >> shift));
+        }
+    }
+    frame->append(payload);
+    return frame;
+}
+
+Task<bool> WebSocket::receive(Message& message) {
+    message.data.clear();
+    message.binary = false;
+    bool fragmented = false;
+
+    while (!closeReceived && !failed) {
+        const char* data = input.data() + inputOffset;
+        const size_t available = input.size() - inputOffset;
+
+        size_t headerSize = 2;
+        uint64_t length = 0;
+        bool complete = false;
+
+        if (available >= 2) {
+            auto b0 = static_cast<uint8_t>(data[0]);
+            auto b1 = static_cast<uint8_t>(data[1]);
+            length = b1 & 0x7F;
+
+            if (length == 126) headerSize += 2;
+            else if (length == 127) headerSize += 8;
+            headerSize += 4;
+
+            if (available >= headerSize) {
+                if (length == 126) {
+                    length = (static_cast<uint64_t>(static_cast<uint8_t>(data[2])) << 8) | static_cast<uint8_t>(data[3]);
+                } else if (length == 127) {
+                    length = 0;
+                    for (int i = 0; i < 8; ++i) length = (length << 8) | static_cast<uint8_t>(data[2 + i]);
+                }
+
+                bool fin = (b0 & 0x80) != 0;
+                auto opcode = static_cast<Opcode>(b0 & 0x0F);
+                bool control = (b0 & 0x08) != 0;
+
+                // Clients must mask, extensions are not negotiated, control
+                // frames are short and unfragmented.
+                // A 64-bit length must have its top bit clear (RFC 6455 5.2).
+                if ((b0 & 0x70) != 0 || (b1 & 0x80) == 0 || (length >> 63) != 0 || (control && (!fin || length > 125)) ||
+                    (opcode != Opcode::Continuation && opcode != Opcode::Text && opcode != Opcode::Binary &&
+                     opcode != Opcode::Close && opcode != Opcode::Ping && opcode != Opcode::Pong)) {
+                    protocolError(1002);
+                    break;
+                }
+                // Checked without adding to length, which comes from the peer.
+                if (!control && (message.data.size() > options.maxMessageSize || length > options.maxMessageSize - message.data.size())) {
+                    protocolError(1009);
+                    break;
+                }
+
+                if (available - headerSize >= length) {
+                    complete = true;
+
+                    char* payload = input.data() + inputOffset + headerSize;
+                    uint8_t key[4];
+                    memcpy(key, payload - 4, 4);
+                    unmask(payload, static_cast<size_t>(length), key);
+                    std::string_view body(payload, static_cast<size_t>(length));
+                    inputOffset += headerSize + static_cast<size_t>(length);
+
+                    // Any traffic proves the peer is alive.
+                    awaitingPong = false;
+
+                    if (opcode == Opcode::Ping) {
+                        if (!closeSent) enqueue(encodeFrame(Opcode::Pong, body));
+                        continue;
+                    }
+                    if (opcode == Opcode::Pong) continue;
+
+                    if (opcode == Opcode::Close) {
+                        closeReceived = true;
+                        uint16_t code = 1000;
+                        if (body.size() >= 2) code = static_cast<uint16_t>((static_cast<uint8_t>(body[0]) << 8) | static_cast<uint8_t>(body[1]));
+                        close(code);
+                        break;
+                    }
+
+                    if ((opcode == Opcode::Continuation) != fragmented) {
+                        protocolError(1002);
+                        break;
+                    }
+                    if (opcode != Opcode::Continuation) message.binary = opcode == Opcode::Binary;
+                    message.data.append(body);
+                    fragmented = !fin;
+
+                    if (fin) {
+                        if (!message.binary && !validUtf8(message.data)) {
+                            protocolError(1007);
+                            break;
+                        }
+                        co_return true;
+                    }
+                    continue;
+                }
+            }
+        }
+
+        if (!complete) {
+            if (inputOffset > 0) {
+                input.erase(0, inputOffset);
+                inputOffset = 0;
+            }
+
+            int bytesRead = co_await connection.receive(input);
+            if (bytesRead <= 0) {
+                failed = true;
+                break;
+            }
+        }
+    }
+
+    co_return false;
+}
+
+bool WebSocket::send(std::string_view data, bool binary) {
+    return send(encodeFrame(binary ? Opcode::Binary : Opcode::Text, data));
+}
+
+bool WebSocket::send(Frame frame) {
+    if (closeSent || failed) return false;
+    return enqueue(std::move(frame));
+}
+
+void WebSocket::close(uint16_t code, std::string_view reason) {
+    if (closeSent || failed) return;
+
+    std::string payload;
+    payload.push_back(static_cast<char>(code >> 8));
+    payload.push_back(static_cast<char>(code));
+    payload.append(reason.substr(0, 123));
+
+    closeSent = true;
+    queue.push_back(encodeFrame(Opcode::Close, payload));
+    flush();
+}
+
+void WebSocket::subscribe(const std::string& topic) {
+    if (topics.insert(topic).second) {
+        Broadcaster::getInstance().subscribe(*this, connection.loop, topic);
+    }
+}
+
+void WebSocket::unsubscribe(const std::string& topic) {
+    if (topics.erase(topic) > 0) {
+        Broadcaster::getInstance().unsubscribe(*this, connection.loop, topic);
+    }
+}
+
+Task<void> WebSocket::finish() {
+    close(1000);
+    connection.loop.cancel(pingTimer);
+    if (writing) co_await DrainAwaiter{ *this };
+}
+
+bool WebSocket::enqueue(Frame frame) {
+    // A subscriber that cannot keep up is dropped rather than buffered forever.
+    if (queue.size() >= options.maxQueuedFrames) {
+        std::cout << "[!] [WebSocket] Send queue full, dropping slow client." << std::endl;
+        abort();
+        return false;
+    }
+
+    queue.push_back(std::move(frame));
+    flush();
+    return true;
+}
+
+void WebSocket::flush() {
+    if (writing || failed || queue.empty()) return;
+
+    writing = true;
+    spawn(writer());
+}
+
+Task<void> WebSocket::writer() {
+    while (!queue.empty() && !failed) {
+        // Two frames per gathered write; the buffers are sent as they are.
+        Frame first = std::move(queue.front());
+        queue.pop_front();
+        Frame second;
+        if (!queue.empty()) {
+            second = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        connection.deadline.arm(options.writeTimeout);
+        bool sent = co_await connection.send(*first, second ? *second : EMPTY);
+        connection.deadline.disarm();
+
+        if (!sent) failed = true;
+    }
+
+    writing = false;
+    if (drained) {
+        std::coroutine_handle<> handle = drained;
+        drained = nullptr;
+        connection.loop.post([handle]() {
+            handle.resume();
+        });
+    }
+}
+
+void WebSocket::abort() {
+    failed = true;
+    queue.clear();
+    CancelIoEx(reinterpret_cast<HANDLE>(connection.socket), nullptr);
+}
+
+void WebSocket::protocolError(uint16_t code) {
+    // Stop reading; the close frame is still flushed by finish().
+    close(code);
+    closeReceived = true;
+}
+
+void WebSocket::onPingTimer() {
+    if (closeSent || failed) return;
+
+    if (awaitingPong) {
+        std::cout << "[!] [WebSocket] No pong within " << options.pingInterval.count() << " ms, closing." << std::endl;
+        abort();
+        return;
+    }
+
+    awaitingPong = true;
+    enqueue(encodeFrame(Opcode::Ping, std::string_view()));
+    connection.loop.schedule(pingTimer, options.pingInterval);
+}
+
+void Broadcaster::subscribe(WebSocket& socket, EventLoop& loop, const std::string& topic) {
+    LoopSubscribers* subscribers;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& entry = loops[&loop];
+        if (!entry) entry = std::make_unique<LoopSubscribers>();
+        subscribers = entry.get();
+        ++topicLoops[topic][&loop];
+    }
+    subscribers->topics[topic].insert(&socket);
+}
+
+void Broadcaster::unsubscribe(WebSocket& socket, EventLoop& loop, const std::string& topic) {
+    LoopSubscribers* subscribers = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto entry = loops.find(&loop);
+        if (entry == loops.end()) return;
+        subscribers = entry->second.get();
+
+        auto topicEntry = topicLoops.find(topic);
+        if (topicEntry != topicLoops.end()) {
+            auto loopEntry = topicEntry->second.find(&loop);
+            if (loopEntry != topicEntry->second.end() && --loopEntry->second == 0) {
+                topicEntry->second.erase(loopEntry);
+            }
+            if (topicEntry->second.empty()) topicLoops.erase(topicEntry);
+        }
+    }
+
+    auto it = subscribers->topics.find(topic);
+    if (it == subscribers->topics.end()) return;
+    it->second.erase(&socket);
+    if (it->second.empty()) subscribers->topics.erase(it);
+}
+
+void Broadcaster::deliver(LoopSubscribers& subscribers, const std::string& topic, const WebSocket::Frame& frame) {
+    auto it = subscribers.topics.find(topic);
+    if (it == subscribers.topics.end()) return;
+
+    // A send may drop a slow subscriber; that only clears its queue, the set
+    // itself is changed when the socket is destroyed.
+    for (WebSocket* socket : it->second) {
+        socket->send(frame);
+    }
+}
+
+size_t Broadcaster::publish(const std::string& topic, std::string_view message, bool binary) {
+    WebSocket::Frame frame = WebSocket::encodeFrame(binary ? WebSocket::Opcode::Binary : WebSocket::Opcode::Text, message);
+
+    std::vector<std::pair<EventLoop*, LoopSubscribers*>> targets;
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto topicEntry = topicLoops.find(topic);
+        if (topicEntry == topicLoops.end()) return 0;
+
+        for (const auto& [loop, subscribers] : topicEntry->second) {
+            targets.emplace_back(loop, loops[loop].get());
+            count += subscribers;
+        }
+    }
+
+    for (const auto& [loop, subscribers] : targets) {
+        if (EventLoop::current() == loop) {
+            deliver(*subscribers, topic, frame);
+            continue;
+        }
+
+        LoopSubscribers* target = subscribers;
+        loop->post([target, topic, frame]() {
+            deliver(*target, topic, frame);
+        });
+    }
+    return count;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Connection.hpp"
+#include "TimerWheel.hpp"
+
+// Server side of a WebSocket connection (RFC 6455). Lives on its connection's
+// event loop: the route handler reads messages with receive(), anything on the
+// same loop may send. Outgoing frames are shared, immutable buffers, so a
+// broadcast frame is encoded once and only its reference is queued per socket.
+class WebSocket {
+public:
+    using Frame = std::shared_ptr<const std::string>;
+
+    enum class Opcode : uint8_t {
+        Continuation = 0x0,
+        Text = 0x1,
+        Binary = 0x2,
+        Close = 0x8,
+        Ping = 0x9,
+        Pong = 0xA
+    };
+
+    struct Message {
+        std::string data;
+        bool binary = false;
+    };
+
+    struct Options {
+        size_t maxMessageSize = 64 * 1024;
+        size_t maxQueuedFrames = 1024;
+        std::chrono::milliseconds pingInterval{ 30000 };
+        std::chrono::milliseconds writeTimeout{ 30000 };
+    };
+
+    // input holds bytes that arrived after the upgrade request.
+    WebSocket(Connection& connection, Options options, std::string input);
+    ~WebSocket();
+
+    WebSocket(const WebSocket&) = delete;
+    WebSocket& operator=(const WebSocket&) = delete;
+
+    // Waits for the next complete message. Resumes with false once the
+    // connection is closed; ping/pong/close are handled internally.
+    Task<bool> receive(Message& message);
+
+    bool send(std::string_view data, bool binary = false);
+    bool send(Frame frame);
+    void close(uint16_t code = 1000, std::string_view reason = std::string_view());
+
+    void subscribe(const std::string& topic);
+    void unsubscribe(const std::string& topic);
+
+    bool isOpen() const {
+        return !closeSent && !failed;
+    }
+
+    // Closes (if still open) and waits for queued frames to be written.
+    Task<void> finish();
+
+    static Frame encodeFrame(Opcode opcode, std::string_view payload);
+
+    // Sec-WebSocket-Accept value for a client's Sec-WebSocket-Key.
+    static std::string acceptKey(const std::string& key);
+
+    // XORs data with the 4-byte masking key, 16 bytes at a time where SSE2 is available.
+    static void unmask(char* data, size_t size, const uint8_t key[4]);
+
+private:
+    struct DrainAwaiter {
+        WebSocket& owner;
+
+        bool await_ready() const noexcept {
+            return !owner.writing;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            owner.drained = handle;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    Connection& connection;
+    Options options;
+
+    std::string input;
+    size_t inputOffset = 0;
+
+    std::deque<Frame> queue;
+    bool writing = false;
+    std::coroutine_handle<> drained;
+
+    bool closeSent = false;
+    bool closeReceived = false;
+    bool failed = false;
+
+    TimerWheel::Timer pingTimer;
+    bool awaitingPong = false;
+
+    std::unordered_set<std::string> topics;
+
+    bool enqueue(Frame frame);
+    void flush();
+    Task<void> writer();
+    void abort();
+    void onPingTimer();
+    void protocolError(uint16_t code);
+};
+
+// Topic-based fan-out. Subscriptions are kept per event loop and only touched
+// on that loop's thread; publish() encodes the frame once and posts a single
+// delivery to each loop that has subscribers for the topic.
+class Broadcaster {
+private:
+    struct LoopSubscribers {
+        std::unordered_map<std::string, std::unordered_set<WebSocket*>> topics;
+    };
+
+    std::mutex mtx;
+    std::unordered_map<EventLoop*, std::unique_ptr<LoopSubscribers>> loops;
+    std::unordered_map<std::string, std::unordered_map<EventLoop*, size_t>> topicLoops;
+
+    Broadcaster() = default;
+
+    Broadcaster(const Broadcaster&) = delete;
+    Broadcaster& operator=(const Broadcaster&) = delete;
+
+    static void deliver(LoopSubscribers& subscribers, const std::string& topic, const WebSocket::Frame& frame);
+
+public:
+    static Broadcaster& getInstance() {
+        static Broadcaster instance;
+        return instance;
+    }
+
+    // Called on the socket's own loop.
+    void subscribe(WebSocket& socket, EventLoop& loop, const std::string& topic);
+    void unsubscribe(WebSocket& socket, EventLoop& loop, const std::string& topic);
+
+    // Safe from any thread. Returns the number of subscribers addressed.
+    size_t publish(const std::string& topic, std::string_view message, bool binary = false);
+};
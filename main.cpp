@@ -1,9 +1,12 @@
 #include <iostream>
 #include <filesystem>
+#include <string>
 
 #include "Internal/Config.hpp"
 #include "Internal/Router.hpp"
 #include "Internal/Server.hpp"
+#include "Internal/Topology.hpp"
+#include "Internal/RateLimiter.hpp"
 
 #include "Controllers/TestController.hpp"
 
@@ -17,10 +20,15 @@ BOOL WINAPI ConsoleHandler(DWORD ctrlType) {
         }
         return TRUE;
     }
+    // Windows has no SIGHUP; Ctrl+Break re-reads config.json instead.
+    if (ctrlType == CTRL_BREAK_EVENT) {
+        Config::getInstance().reload();
+        return TRUE;
+    }
     return FALSE;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
 	std::cout << "[*] Starting..." << std::endl;
 
     SetConsoleCtrlHandler(ConsoleHandler, TRUE);
@@ -48,34 +56,59 @@ int main() {
     }
 
     config.outputConfig();
+    CpuTopology::getInstance().outputTopology(*Config::current());
+    config.watch();
+
+    // --takeover: replace a running instance without dropping connections.
+    SOCKET inherited = INVALID_SOCKET;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--takeover") {
+            inherited = SocketHandover::acquire(Config::current()->port);
+        }
+    }
 
     Router& router = Router::getInstance();
-    std::filesystem::path publicPath = cwdPath / "public";
-    router.setPublicPath(publicPath);
+
+    router.use(Middleware::RequestId());
+    router.use(Middleware::Cors());
 
     TestController testController;
     router.addRoute("GET", "/status", [&testController](Request& request) {
         return testController.statusPage(request);
     });
+    // JSON parsing is the expensive path: 5 requests/s per client, bursts of 10.
     router.addRoute("POST", "/json", [&testController](Request& request) {
         return testController.testJson(request);
-    });
+    }, Middleware::RateLimit({ 5.0, 10.0, 1 << 16 }));
     router.addRoute("POST", "/hello", [&testController](Request& request) {
         return testController.hello(request);
     });
+    router.addRoute("POST", "/upload", [&testController](Request& request) {
+        return testController.upload(request);
+    });
+    router.addAsyncRoute("GET", "/delay", [&testController](Request& request) {
+        return testController.delayed(request);
+    });
+    router.addWebSocketRoute("/ws/:room", [&testController](WebSocket& socket, Request& request) {
+        return testController.chat(socket, request);
+    });
+    router.addProxyRoute("/api/*rest", "backend");
 
     try {
-        Server server;
+        Server server(inherited);
         server.run(shutdownEvent);
+        server.drain(std::chrono::milliseconds(Config::current()->drainTimeout));
     }
     catch (const std::runtime_error& e) {
         std::cerr << "[!] Server failed to start: " << e.what() << std::endl;
 
+        config.stopWatching();
         WSACloseEvent(shutdownEvent);
         WSACleanup();
         return -1;
     }
 
+    config.stopWatching();
     WSACloseEvent(shutdownEvent);
     WSACleanup();
 
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""Loopback check for the reverse proxy.
+
+Serves the "backend" upstream from config.json on 127.0.0.1:9000 and :9001,
+sends requests through a running server on /api/*, and checks what each side
+sees: hop-by-hop headers (including those named in Connection) are stripped
+in both directions, X-Forwarded-* are added, and chunked responses pass
+through, gzip-compressed when the client accepts it.
+
+    python scripts/proxy_check.py [--server 127.0.0.1:8080] [--upstreams 9000,9001]
+
+Exits non-zero on the first failed check. Python 3.8+, standard library only.
+"""
+
+import argparse
+import gzip
+import http.client
+import http.server
+import sys
+import threading
+import time
+
+CHUNKS = [b"chunk %d " % i * 64 for i in range(8)]
+seen = []
+
+
+class Upstream(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, format, *args):
+        pass
+
+    def do_GET(self):
+        if self.path == "/health":
+            self.send_response(200)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        seen.append(dict((name.lower(), value) for name, value in self.headers.items()))
+
+        if self.path.startswith("/api/chunked"):
+            self.send_response(200)
+            self.send_header("Content-Type", "text/plain")
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for chunk in CHUNKS:
+                self.wfile.write(b"%x\r\n%s\r\n" % (len(chunk), chunk))
+                self.wfile.flush()
+            self.wfile.write(b"0\r\n\r\n")
+            return
+
+        body = b"echo"
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("Connection", "keep-alive, X-Upstream-Hop")
+        self.send_header("X-Upstream-Hop", "1")
+        self.send_header("X-End-To-End", "1")
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def check(condition, message):
+    if not condition:
+        print("FAIL: " + message)
+        sys.exit(1)
+    print("ok:   " + message)
+
+
+def request(server, path, headers):
+    host, port = server.rsplit(":", 1)
+    connection = http.client.HTTPConnection(host, int(port), timeout=10)
+    connection.putrequest("GET", path, skip_accept_encoding=True)
+    for name, value in headers.items():
+        connection.putheader(name, value)
+    connection.endheaders()
+    response = connection.getresponse()
+    body = response.read()
+    connection.close()
+    return response, body
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Loopback check for the reverse proxy.")
+    parser.add_argument("--server", default="127.0.0.1:8080")
+    parser.add_argument("--upstreams", default="9000,9001")
+    args = parser.parse_args()
+
+    for port in args.upstreams.split(","):
+        upstream = http.server.ThreadingHTTPServer(("127.0.0.1", int(port)), Upstream)
+        threading.Thread(target=upstream.serve_forever, daemon=True).start()
+
+    # Let a health check mark the upstreams up.
+    time.sleep(6)
+
+    response, body = request(args.server, "/api/echo", {
+        "Connection": "keep-alive, X-Client-Hop",
+        "X-Client-Hop": "1",
+        "X-End-To-End": "1",
+        "TE": "trailers",
+    })
+    check(response.status == 200 and body == b"echo", "plain request is relayed")
+    sent = seen[-1]
+    check("x-end-to-end" in sent, "end-to-end request header reaches the upstream")
+    check("x-client-hop" not in sent, "request header named in Connection is stripped")
+    check("te" not in sent, "hop-by-hop request header is stripped")
+    check(sent.get("x-forwarded-for", "").endswith("127.0.0.1"), "X-Forwarded-For names the client")
+    check(sent.get("x-forwarded-proto") == "http", "X-Forwarded-Proto is http")
+    check(response.getheader("X-End-To-End") == "1", "end-to-end response header reaches the client")
+    check(response.getheader("X-Upstream-Hop") is None, "response header named in Connection is stripped")
+
+    response, body = request(args.server, "/api/chunked", {})
+    check(response.getheader("Transfer-Encoding", "").lower() == "chunked", "chunked response stays chunked")
+    check(response.getheader("Content-Encoding") is None and body == b"".join(CHUNKS), "chunked body is passed through")
+
+    response, body = request(args.server, "/api/chunked", {"Accept-Encoding": "gzip"})
+    check(response.getheader("Content-Encoding") == "gzip", "chunked response is gzip-compressed")
+    check("Accept-Encoding" in response.getheader("Vary", ""), "compressed response varies on Accept-Encoding")
+    check(gzip.decompress(body) == b"".join(CHUNKS), "compressed body decodes to the upstream's")
+
+    print("All proxy checks passed.")
+
+
+if __name__ == "__main__":
+    main()